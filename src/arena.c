@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "smash.h"
+
+/*
+ * ポインタを進めるだけの領域確保.
+ * 個別の解放はできず, free_arena で全体をまとめて解放する.
+ * arena_mark と arena_release で, 記録した位置より後に確保したものだけを捨てることもできる.
+ * arena_use_huge_pages で, この後に作るアリーナを huge page で確保する.
+ */
+
+#define CHUNK_SIZE  (1024*1024)
+#define HUGE_SIZE   (2*1024*1024)
+#define ALIGN       16
+
+struct ArenaChunk
+{
+    struct ArenaChunk *next;
+    size_t size;
+};
+
+/* make_arena の既定. スレッドを始める前に決め, 後からは変えない */
+static bool use_huge;
+
+static struct ArenaChunk *
+new_chunk(Arena *a, size_t need)
+{
+    struct ArenaChunk *c;
+    size_t unit = a->huge ? HUGE_SIZE : CHUNK_SIZE;
+    size_t size = (need + sizeof(struct ArenaChunk) + unit - 1) / unit * unit;
+    void *m = MAP_FAILED;
+
+    if (a->spare && a->spare->size >= need + sizeof(struct ArenaChunk))
+    {
+        c = a->spare;
+        a->spare = NULL;
+        c->next = a->chunk;
+        a->chunk = c;
+        a->reserved += c->size;
+        return c;
+    }
+
+#ifdef MAP_HUGETLB
+    if (a->huge) m = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+#endif
+    if (m == MAP_FAILED)
+    {
+        m = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (m == MAP_FAILED) eperror("mmap");
+#ifdef MADV_HUGEPAGE
+        /* 予約済みの huge page が無ければ透過的 huge page を頼る */
+        if (a->huge) madvise(m, size, MADV_HUGEPAGE);
+#endif
+    }
+
+    c = (struct ArenaChunk*)m;
+    c->size = size;
+    c->next = a->chunk;
+    a->chunk = c;
+    a->reserved += size;
+    return c;
+}
+
+/* ドライバの --huge-pages. 字句, AST, 名前の全てのアリーナが 2MB 単位になる */
+void
+arena_use_huge_pages(bool huge)
+{
+    use_huge = huge;
+}
+
+Arena *
+make_arena()
+{
+    Arena *a = (Arena*)xmalloc(sizeof(Arena));
+    a->chunk = a->spare = NULL;
+    a->cur = a->end = NULL;
+    a->used = 0;
+    a->reserved = 0;
+    a->huge = use_huge;
+    return a;
+}
+
+void
+free_arena(Arena *a)
+{
+    struct ArenaChunk *c, *next;
+    for (c = a->chunk; c; c = next)
+    {
+        next = c->next;
+        munmap(c, c->size);
+    }
+    if (a->spare) munmap(a->spare, a->spare->size);
+    free(a);
+}
+
+void *
+arena_alloc(Arena *a, size_t size)
+{
+    void *p;
+    size = (size + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+    if ((size_t)(a->end - a->cur) < size)
+    {
+        struct ArenaChunk *c = new_chunk(a, size + ALIGN);
+        a->cur = (char*)c + ((sizeof(struct ArenaChunk) + ALIGN - 1) & ~(size_t)(ALIGN - 1));
+        a->end = (char*)c + c->size;
+    }
+    p = a->cur;
+    a->cur += size;
+    a->used += size;
+    return p;
+}
+
+size_t
+arena_used(const Arena *a)
+{
+    return a->used;
+}
+
+void
+arena_report(FILE *f, const char *name, const Arena *a)
+{
+    fprintf(f, "%-8s %10zu bytes used, %10zu bytes reserved\n", name, a->used, a->reserved);
+}
+
+ArenaMark
+arena_mark(const Arena *a)
+{
+    return (ArenaMark){a->chunk, a->cur, a->used};
+}
+
+/*
+ * m より後に確保した領域をすべて捨てる. m より後に作ったチャンクは返すが,
+ * 宣言ごとに mmap と munmap を繰り返さないよう 1 つだけ取っておく.
+ */
+void
+arena_release(Arena *a, ArenaMark m)
+{
+    struct ArenaChunk *c;
+
+    while ((c = a->chunk) != m.chunk)
+    {
+        a->chunk = c->next;
+        a->reserved -= c->size;
+        if (a->spare && a->spare->size >= c->size)
+        {
+            munmap(c, c->size);
+            continue;
+        }
+        if (a->spare) munmap(a->spare, a->spare->size);
+        a->spare = c;
+    }
+    c = a->chunk;
+    a->cur = m.cur;
+    a->end = c ? (char*)c + c->size : NULL;
+    a->used = m.used;
+}
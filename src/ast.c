@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "smash.h"
+
+/*
+ * 配列による AST.
+ * ノードは 32 ビットの番号で指し, 種類と子 3 つを別々の配列に持つ.
+ * リテラルの値や子の列などノードに収まらないものは副表に置く.
+ * 番号 0 は「ノード無し」を表す.
+ *
+ * 各種類での a, b, c の意味:
+ *   AST_IDENT, KEY_GOTO     a = シンボル
+ *   AST_NUMBER              a, b = 値の下位, 上位 32 ビット (T_LDOUBLE は a = ldbl の添字), c = 型
+ *   AST_STRING, AST_CHAR    a = str の添字
+ *   単項演算子, KEY_RETURN  a = 被演算子
+ *   AST_TERNARY, KEY_IF     a = 条件, b = 真, c = 偽
+ *   AST_FUNCCALL            a = 関数, b = list の開始位置, c = 引数の数
+ *   AST_COMPOUND, AST_DECL  b = list の開始位置, c = 文・宣言子の数
+ *   AST_LABEL               a = ラベル, b = 文
+ *   AST_LVAR                a = 変数名, b = 初期化子, c = type の添字
+ *   '.'                     a = 構造体, b = メンバ名
+ *   二項演算子              a = 左, b = 右
+ */
+
+enum
+{
+    SHAPE_NONE,
+    SHAPE_SYM,
+    SHAPE_NUMBER,
+    SHAPE_STRING,
+    SHAPE_UNARY,
+    SHAPE_TERNARY,
+    SHAPE_FUNCCALL,
+    SHAPE_COMPOUND,
+    SHAPE_LABEL,
+    SHAPE_LVAR,
+    SHAPE_MEMBER,
+    SHAPE_BINARY,
+};
+
+/* 変換待ちのノードと, 変換後の番号を書き込む場所 */
+typedef struct Pending
+{
+    const Node *node;
+    AstRef *(*field)(Ast *t);
+    unsigned int at;
+} Pending;
+
+static void   *grow(void *p, int *size, int need, size_t elem);
+static int    shape(int kind);
+static AstRef *field_a(Ast *t);
+static AstRef *field_b(Ast *t);
+static AstRef *field_c(Ast *t);
+static AstRef *field_list(Ast *t);
+
+static void *
+grow(void *p, int *size, int need, size_t elem)
+{
+    if (need <= *size) return p;
+    while (*size < need) *size = *size ? *size * 2 : 256;
+    return xrealloc(p, elem * *size);
+}
+
+static int
+shape(int kind)
+{
+    switch (kind)
+    {
+        case AST_IDENT:
+        case KEY_GOTO:
+            return SHAPE_SYM;
+        case AST_NUMBER:
+            return SHAPE_NUMBER;
+        case AST_STRING:
+        case AST_CHAR:
+            return SHAPE_STRING;
+        case AST_GETADDR: case AST_DEREF:
+        case AST_PLUS:    case AST_MINUS:
+        case OP_PRE_INC:  case OP_PRE_DEC:
+        case OP_POST_INC: case OP_POST_DEC:
+        case '~': case '!':
+        case KEY_RETURN:
+            return SHAPE_UNARY;
+        case AST_TERNARY:
+        case KEY_IF:
+            return SHAPE_TERNARY;
+        case AST_FUNCCALL:
+            return SHAPE_FUNCCALL;
+        case AST_COMPOUND:
+        case AST_DECL:
+            return SHAPE_COMPOUND;
+        case AST_LABEL:
+            return SHAPE_LABEL;
+        case AST_LVAR:
+            return SHAPE_LVAR;
+        case '.':
+            return SHAPE_MEMBER;
+        case OP_CAST:
+            return SHAPE_NONE;
+    }
+    return SHAPE_BINARY;
+}
+
+static AstRef *field_a(Ast *t)    { return t->a; }
+static AstRef *field_b(Ast *t)    { return t->b; }
+static AstRef *field_c(Ast *t)    { return t->c; }
+static AstRef *field_list(Ast *t) { return t->list; }
+
+Ast *
+make_ast_tree()
+{
+    Ast *t = (Ast*)xcalloc(1, sizeof(Ast));
+    ast_clear(t);
+    return t;
+}
+
+void
+free_ast_tree(Ast *t)
+{
+    free(t->kind);
+    free(t->a);
+    free(t->b);
+    free(t->c);
+    free(t->ldbl);
+    free(t->str);
+    free(t->list);
+    free(t->type);
+    free(t->stack);
+    free(t);
+}
+
+/* 空にする. 確保した配列はそのまま次の木に使う */
+void
+ast_clear(Ast *t)
+{
+    t->len = t->nldbl = t->nstr = t->nlist = t->ntype = 0;
+    /* 0 番は「無し」. 副表の 0 番も同様に空けておく */
+    ast_add(t, 0, 0, 0, 0);
+    ast_add_type(t, NULL);
+}
+
+/* 使用中のバイト数 */
+size_t
+ast_bytes(const Ast *t)
+{
+    return t->len * (sizeof(t->kind[0]) + 3*sizeof(AstRef))
+         + t->nldbl * sizeof(t->ldbl[0])
+         + t->nstr  * sizeof(t->str[0])
+         + t->nlist * sizeof(t->list[0])
+         + t->ntype * sizeof(t->type[0]);
+}
+
+AstRef
+ast_add(Ast *t, int kind, AstRef a, AstRef b, AstRef c)
+{
+    if (t->len >= t->size)
+    {
+        t->size = t->size ? t->size * 2 : 256;
+        t->kind = (unsigned short*)xrealloc(t->kind, sizeof(t->kind[0])*t->size);
+        t->a = (AstRef*)xrealloc(t->a, sizeof(AstRef)*t->size);
+        t->b = (AstRef*)xrealloc(t->b, sizeof(AstRef)*t->size);
+        t->c = (AstRef*)xrealloc(t->c, sizeof(AstRef)*t->size);
+    }
+    t->kind[t->len] = kind;
+    t->a[t->len] = a;
+    t->b[t->len] = b;
+    t->c[t->len] = c;
+    return t->len++;
+}
+
+/* 値は val の型 type に対応するメンバから取る */
+AstRef
+ast_add_number(Ast *t, int type, const Node *val)
+{
+    unsigned long long bits = 0;
+
+    switch (type)
+    {
+        case T_INT:     bits = (unsigned int)val->i;  break;
+        case T_UINT:    bits = val->ui;               break;
+        case T_LINT:    case T_ULINT:
+        case T_LLINT:   case T_ULLINT:
+            bits = val->ulli;
+            break;
+        case T_FLOAT:   memcpy(&bits, &val->f, sizeof(val->f)); break;
+        case T_DOUBLE:  memcpy(&bits, &val->d, sizeof(val->d)); break;
+        case T_LDOUBLE:
+            t->ldbl = (long double*)grow(t->ldbl, &t->ldbl_size, t->nldbl + 1, sizeof(long double));
+            t->ldbl[t->nldbl] = val->ld;
+            return ast_add(t, AST_NUMBER, t->nldbl++, 0, type);
+    }
+    return ast_add(t, AST_NUMBER, (AstRef)bits, (AstRef)(bits >> 32), type);
+}
+
+AstRef
+ast_add_string(Ast *t, int kind, String *str)
+{
+    t->str = (String**)grow(t->str, &t->str_size, t->nstr + 1, sizeof(String*));
+    t->str[t->nstr] = str;
+    return ast_add(t, kind, t->nstr++, 0, 0);
+}
+
+/* 長さ n の子の列を確保して開始位置を返す */
+unsigned int
+ast_add_list(Ast *t, const AstRef *refs, int n)
+{
+    unsigned int start = t->nlist;
+    t->list = (AstRef*)grow(t->list, &t->list_size, t->nlist + n, sizeof(AstRef));
+    if (n == 0) return start;
+    if (refs) memcpy(t->list + start, refs, sizeof(AstRef)*n);
+    else      memset(t->list + start, 0, sizeof(AstRef)*n);
+    t->nlist += n;
+    return start;
+}
+
+unsigned int
+ast_add_type(Ast *t, Type *type)
+{
+    t->type = (Type**)grow(t->type, &t->type_size, t->ntype + 1, sizeof(Type*));
+    t->type[t->ntype] = type;
+    return t->ntype++;
+}
+
+/* ノード r の数値を val の対応するメンバに取り出し, 型を返す */
+int
+ast_number(const Ast *t, AstRef r, Node *val)
+{
+    unsigned long long bits = t->a[r] | (unsigned long long)t->b[r] << 32;
+    int type = t->c[r];
+
+    switch (type)
+    {
+        case T_INT:     val->i = (int)bits;          break;
+        case T_UINT:    val->ui = (unsigned int)bits; break;
+        case T_LINT:    case T_ULINT:
+        case T_LLINT:   case T_ULLINT:
+            val->ulli = bits;
+            break;
+        case T_FLOAT:   memcpy(&val->f, &bits, sizeof(val->f)); break;
+        case T_DOUBLE:  memcpy(&val->d, &bits, sizeof(val->d)); break;
+        case T_LDOUBLE: val->ld = t->ldbl[t->a[r]]; break;
+    }
+    return type;
+}
+
+/*
+ * ポインタによる木を t に写し, 根の番号を返す.
+ * 親を先に確保して子の番号を後から埋めるので, 深い木でも再帰しない.
+ * 番号は前順に振られる.
+ */
+AstRef
+ast_from_node(Ast *t, const Node *root)
+{
+    Pending *stack = t->stack;
+    int sp = 0;
+    AstRef top = 0, r;
+
+#define PUSH(n, f, i) \
+    do { \
+        if (n) \
+        { \
+            stack = t->stack = (Pending*)grow(t->stack, &t->stack_size, sp + 1, sizeof(Pending)); \
+            stack[sp++] = (Pending){(n), (f), (i)}; \
+        } \
+    } while (0)
+
+    if (!root) return 0;
+    PUSH(root, NULL, 0);
+    while (sp > 0)
+    {
+        Pending pd = stack[--sp];
+        const Node *node = pd.node;
+        int i, n;
+
+        switch (shape(node->kind))
+        {
+            case SHAPE_SYM:
+                r = ast_add(t, node->kind, node->sym, 0, 0);
+                break;
+            case SHAPE_NUMBER:
+                r = ast_add_number(t, node->type->kind, node);
+                break;
+            case SHAPE_STRING:
+                r = ast_add_string(t, node->kind, node->value);
+                break;
+            case SHAPE_UNARY:
+                r = ast_add(t, node->kind, 0, 0, 0);
+                PUSH(node->operand, field_a, r);
+                break;
+            case SHAPE_TERNARY:
+                r = ast_add(t, node->kind, 0, 0, 0);
+                /* 前順に振るため後に読む子から積む */
+                PUSH(node->e, field_c, r);
+                PUSH(node->t, field_b, r);
+                PUSH(node->c, field_a, r);
+                break;
+            case SHAPE_FUNCCALL:
+                n = vec_cnt(node->args);
+                r = ast_add(t, node->kind, 0, ast_add_list(t, NULL, n), n);
+                for (i = n - 1; i >= 0; i--)
+                {
+                    PUSH((Node*)node->args->body[i], field_list, t->b[r] + i);
+                }
+                PUSH(node->func, field_a, r);
+                break;
+            case SHAPE_COMPOUND:
+                n = vec_cnt(node->stats);
+                r = ast_add(t, node->kind, 0, ast_add_list(t, NULL, n), n);
+                for (i = n - 1; i >= 0; i--)
+                {
+                    PUSH((Node*)node->stats->body[i], field_list, t->b[r] + i);
+                }
+                break;
+            case SHAPE_LABEL:
+                r = ast_add(t, node->kind, node->label, 0, 0);
+                PUSH(node->stat, field_b, r);
+                break;
+            case SHAPE_LVAR:
+                r = ast_add(t, node->kind, node->varname, 0, 0);
+                if (node->type) t->c[r] = ast_add_type(t, node->type);
+                PUSH(node->init, field_b, r);
+                break;
+            case SHAPE_MEMBER:
+                r = ast_add(t, node->kind, 0, node->member, 0);
+                PUSH(node->obj, field_a, r);
+                break;
+            case SHAPE_BINARY:
+                r = ast_add(t, node->kind, 0, 0, 0);
+                PUSH(node->right, field_b, r);
+                PUSH(node->left,  field_a, r);
+                break;
+            default:
+                r = ast_add(t, node->kind, 0, 0, 0);
+                break;
+        }
+
+        if (pd.field) pd.field(t)[pd.at] = r;
+        else          top = r;
+    }
+#undef PUSH
+
+    return top;
+}
@@ -0,0 +1,599 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "smash.h"
+
+/*
+ * 字句解析の結果のキャッシュ.
+ * ソースの xxHash64 を名前にしたファイルにトークン列・識別子の表・字句をそのまま書き,
+ * 同じ内容のソースを次に読むときは mmap して字句解析の代わりに再生する.
+ * ファイルは
+ *   CacheHeader, CachedToken[ntokens], CachedLiteral[nlits], CachedSym[nsyms], 字句
+ * の順に並ぶ. トークンは 8 バイトで, 字句や値を持つものだけが CachedLiteral を指す.
+ * 書いた計算機と同じ版の smash で読む前提で, バイト順などは変換しない.
+ */
+
+#define CACHE_MAGIC "SMTOK002"
+#define NONE        0xffffffffu  // 字句の無いトークンの arg, 字句の無いリテラルの text
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+typedef unsigned long long u64;
+
+typedef struct
+{
+    char magic[8];
+    unsigned int layout;         // 各表の要素の大きさ. 別の版の書いたものを読まないように
+    unsigned int ntokens;
+    unsigned int nlits;
+    unsigned int nsyms;
+    u64 text_size;
+    u64 hash;                    // ソースの xxHash64
+    u64 src_size;
+} CacheHeader;
+
+/* arg は識別子ならシンボル, それ以外は CachedLiteral の添字か NONE */
+typedef struct
+{
+    unsigned int kind;
+    unsigned int arg;
+} CachedToken;
+
+/* 字句と値を持つトークン. 数値以外の値は使わない */
+typedef struct
+{
+    unsigned int text;           // 字句の表での位置
+    int len;
+    int id;
+    unsigned char value[sizeof(long double)];
+} CachedLiteral;
+
+typedef struct
+{
+    unsigned int text;
+    int len;
+} CachedSym;
+
+#define LAYOUT (sizeof(CachedToken) | sizeof(CachedLiteral) << 8 | sizeof(CachedSym) << 16)
+
+struct TokenCache
+{
+    char *path;                  // キャッシュファイルの名前
+    u64 hash;
+    size_t src_size;
+    Intern *syms;
+
+    /* 再生. 記録するときは tokens が NULL */
+    void *map;
+    size_t map_size;
+    const CachedToken *tokens;
+    unsigned int ntokens;
+    unsigned int next;
+    const CachedLiteral *lits;
+    const char *text;
+
+    /* 記録 */
+    CachedToken *rec;
+    unsigned int nrec;
+    unsigned int rec_size;
+    CachedLiteral *rlits;
+    unsigned int nlits;
+    unsigned int lits_size;
+    char *rtext;
+    unsigned int ntext;
+    unsigned int text_size;
+    unsigned int keyword[KIND_END]; // 予約語ごとに最初のリテラルの添字 + 1. 同じ綴りなら使い回す
+    int nsyms;                   // 記録したトークンの最大のシンボル + 1
+    bool failed;                 // 大きすぎるなどで書かない
+};
+
+static u64  rotl(u64 x, int r);
+static u64  read64(const unsigned char *p);
+static unsigned int read32(const unsigned char *p);
+static u64  xxh_round(u64 acc, u64 input);
+static u64  xxh_merge(u64 acc, u64 val);
+static bool number_id(int id);
+static bool load(struct TokenCache *c);
+static void *grow(void *p, unsigned int *size, unsigned int need, size_t elem);
+static bool add_text(struct TokenCache *c, const char *str, int len, unsigned int *at);
+static unsigned int add_literal(struct TokenCache *c, const Token *tk);
+static void save(struct TokenCache *c);
+static bool write_all(int fd, const void *p, size_t len);
+
+static u64
+rotl(u64 x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static u64
+read64(const unsigned char *p)
+{
+    u64 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static unsigned int
+read32(const unsigned char *p)
+{
+    unsigned int v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static u64
+xxh_round(u64 acc, u64 input)
+{
+    acc += input * PRIME64_2;
+    return rotl(acc, 31) * PRIME64_1;
+}
+
+static u64
+xxh_merge(u64 acc, u64 val)
+{
+    acc ^= xxh_round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+/* xxHash64. リトルエンディアンの計算機での値は参照実装と一致する */
+unsigned long long
+xxh64(const void *data, size_t len, unsigned long long seed)
+{
+    const unsigned char *p = (const unsigned char*)data, *end = p + len;
+    u64 h;
+
+    if (len >= 32)
+    {
+        u64 v1 = seed + PRIME64_1 + PRIME64_2;
+        u64 v2 = seed + PRIME64_2;
+        u64 v3 = seed;
+        u64 v4 = seed - PRIME64_1;
+        for (; end - p >= 32; p += 32)
+        {
+            v1 = xxh_round(v1, read64(p));
+            v2 = xxh_round(v2, read64(p + 8));
+            v3 = xxh_round(v3, read64(p + 16));
+            v4 = xxh_round(v4, read64(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    }
+    else
+    {
+        h = seed + PRIME64_5;
+    }
+    h += len;
+
+    for (; end - p >= 8; p += 8)
+    {
+        h ^= xxh_round(0, read64(p));
+        h = rotl(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (end - p >= 4)
+    {
+        h ^= (u64)read32(p) * PRIME64_1;
+        h = rotl(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++)
+    {
+        h ^= *p * PRIME64_5;
+        h = rotl(h, 11) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+/* 字句解析器が数値に付ける型か */
+static bool
+number_id(int id)
+{
+    switch (id)
+    {
+        case T_INT:   case T_LINT:   case T_LLINT:
+        case T_UINT:  case T_ULINT:  case T_ULLINT:
+        case T_FLOAT: case T_DOUBLE: case T_LDOUBLE:
+            return true;
+    }
+    return false;
+}
+
+/*
+ * キャッシュファイルを mmap して確かめ, 識別子を記号表に順に登録する.
+ * 壊れていたり別のソースのものだったりすれば false.
+ * 種類と数値の型は表の添字に使われるので, 範囲の外なら再生せずに字句解析し直す.
+ */
+static bool
+load(struct TokenCache *c)
+{
+    const CacheHeader *hd;
+    const CachedSym *sym;
+    struct stat st;
+    unsigned int i;
+    int fd;
+
+    if ((fd = open(c->path, O_RDONLY)) < 0) return false;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(CacheHeader))
+    {
+        close(fd);
+        return false;
+    }
+    c->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (c->map == MAP_FAILED)
+    {
+        c->map = NULL;
+        return false;
+    }
+    c->map_size = st.st_size;
+
+    hd = (const CacheHeader*)c->map;
+    if (memcmp(hd->magic, CACHE_MAGIC, sizeof(hd->magic)) != 0
+     || hd->layout != LAYOUT
+     || hd->hash != c->hash || hd->src_size != c->src_size
+     || hd->ntokens == 0
+     || c->map_size != sizeof(CacheHeader) + (u64)hd->ntokens * sizeof(CachedToken)
+                       + (u64)hd->nlits * sizeof(CachedLiteral)
+                       + (u64)hd->nsyms * sizeof(CachedSym) + hd->text_size)
+    {
+        return false;
+    }
+    c->tokens = (const CachedToken*)(hd + 1);
+    c->ntokens = hd->ntokens;
+    c->lits = (const CachedLiteral*)(c->tokens + c->ntokens);
+    sym = (const CachedSym*)(c->lits + hd->nlits);
+    c->text = (const char*)(sym + hd->nsyms);
+
+    /* 記号表に登録し始めると取り消せないので, 先にすべて確かめる */
+    for (i = 0; i < c->ntokens; i++)
+    {
+        const CachedToken *ct = &c->tokens[i];
+        if (ct->kind >= KIND_END) return false;
+        if (ct->kind == TK_IDENT ? ct->arg >= hd->nsyms : ct->arg != NONE && ct->arg >= hd->nlits) return false;
+        if (ct->kind == TK_NUMBER && (ct->arg == NONE || !number_id(c->lits[ct->arg].id))) return false;
+    }
+    if (c->tokens[c->ntokens-1].kind != TK_EOF) return false;
+    for (i = 0; i < hd->nlits; i++)
+    {
+        if (c->lits[i].len < 0 || (u64)c->lits[i].text + c->lits[i].len > hd->text_size) return false;
+    }
+    for (i = 0; i < hd->nsyms; i++)
+    {
+        if (sym[i].len < 0 || (u64)sym[i].text + sym[i].len > hd->text_size) return false;
+    }
+    for (i = 0; i < hd->nsyms; i++)
+    {
+        if (intern(c->syms, c->text + sym[i].text, sym[i].len) != (int)i) return false;
+    }
+    return true;
+}
+
+/*
+ * dir にある src のキャッシュを開く. あれば以後 cache_replay で再生し,
+ * 無ければ cache_record で記録して EOF で書き出す. syms は空の記号表でなければならない.
+ */
+struct TokenCache *
+cache_open(const char *dir, const char *src, size_t size, Intern *syms)
+{
+    struct TokenCache *c = (struct TokenCache*)xcalloc(1, sizeof(struct TokenCache));
+    size_t n = strlen(dir) + 32;
+
+    c->hash = xxh64(src, size, 0);
+    c->src_size = size;
+    c->syms = syms;
+    c->path = (char*)xmalloc(n);
+    snprintf(c->path, n, "%s/%016llx.tok", dir, c->hash);
+
+    if (!load(c))
+    {
+        /* 途中まで登録した識別子は取り消せないので, そうなれば記録もしない */
+        if (syms->nsyms != 0) c->failed = true;
+        if (c->map) munmap(c->map, c->map_size);
+        c->map = NULL;
+        c->tokens = NULL;
+        mkdir(dir, 0777);
+    }
+    return c;
+}
+
+void
+cache_close(struct TokenCache *c)
+{
+    if (c->map) munmap(c->map, c->map_size);
+    free(c->rec);
+    free(c->rlits);
+    free(c->rtext);
+    free(c->path);
+    free(c);
+}
+
+/* 次のトークンを再生する. 記録しているときは false. EOF の後は EOF を繰り返す */
+bool
+cache_replay(struct TokenCache *c, Token *tk)
+{
+    const CachedToken *ct;
+    const CachedLiteral *lit;
+
+    if (!c->tokens) return false;
+    ct = &c->tokens[c->next];
+    if (c->next + 1 < c->ntokens) c->next++;
+
+    tk->kind = ct->kind;
+    if (ct->kind == TK_IDENT)
+    {
+        tk->sym = ct->arg;
+        tk->text = sym_name(c->syms, ct->arg);
+        tk->len = sym_len(c->syms, ct->arg);
+    }
+    else if (ct->arg == NONE)
+    {
+        tk->text = NULL;
+        tk->len = 0;
+    }
+    else
+    {
+        lit = &c->lits[ct->arg];
+        tk->text = c->text + lit->text;
+        tk->len = lit->len;
+        tk->id = lit->id;
+        memcpy(&tk->i, lit->value, sizeof(lit->value));
+    }
+    return true;
+}
+
+/* 記録用の配列を need 個まで伸ばす. 32 ビットの添字に収まらなければ NULL */
+static void *
+grow(void *p, unsigned int *size, unsigned int need, size_t elem)
+{
+    u64 n = *size;
+
+    if (need <= *size) return p;
+    while (n < need) n = n ? n * 2 : 1024;
+    if (n >= NONE) return NULL;
+    *size = n;
+    return xrealloc(p, elem * n);
+}
+
+static bool
+add_text(struct TokenCache *c, const char *str, int len, unsigned int *at)
+{
+    char *t;
+
+    if ((u64)c->ntext + len >= NONE) return false;
+    if (!(t = (char*)grow(c->rtext, &c->text_size, c->ntext + len, 1))) return false;
+    c->rtext = t;
+    memcpy(c->rtext + c->ntext, str, len);
+    *at = c->ntext;
+    c->ntext += len;
+    return true;
+}
+
+/* tk の字句と値を記録して添字を返す. 予約語は綴りが同じなら使い回す. 失敗すれば NONE */
+static unsigned int
+add_literal(struct TokenCache *c, const Token *tk)
+{
+    CachedLiteral *lit, *l;
+    unsigned int k = c->keyword[tk->kind];
+
+    if (tk->kind > TK_INVALID && k)
+    {
+        lit = &c->rlits[k-1];
+        if (lit->len == tk->len && memcmp(c->rtext + lit->text, tk->text, tk->len) == 0) return k - 1;
+    }
+    if (!(l = (CachedLiteral*)grow(c->rlits, &c->lits_size, c->nlits + 1, sizeof(CachedLiteral)))) return NONE;
+    c->rlits = l;
+    lit = &c->rlits[c->nlits];
+    memset(lit, 0, sizeof(CachedLiteral));
+    if (!add_text(c, tk->text, tk->len, &lit->text)) return NONE;
+    lit->len = tk->len;
+    if (tk->kind == TK_NUMBER)
+    {
+        lit->id = tk->id;
+        memcpy(lit->value, &tk->i, sizeof(lit->value));
+    }
+    if (tk->kind > TK_INVALID && !k) c->keyword[tk->kind] = c->nlits + 1;
+    return c->nlits++;
+}
+
+/* 読んだトークンを記録する. EOF を記録したらファイルに書く */
+void
+cache_record(struct TokenCache *c, const Token *tk)
+{
+    CachedToken *ct, *r;
+
+    if (c->tokens || c->failed) return;
+    if (!(r = (CachedToken*)grow(c->rec, &c->rec_size, c->nrec + 1, sizeof(CachedToken))))
+    {
+        c->failed = true;
+        return;
+    }
+    c->rec = r;
+    ct = &c->rec[c->nrec++];
+    ct->kind = tk->kind;
+    ct->arg = NONE;
+    if (tk->kind == TK_IDENT)
+    {
+        ct->arg = tk->sym;
+        if (tk->sym >= c->nsyms) c->nsyms = tk->sym + 1;
+    }
+    else if (tk->text && (ct->arg = add_literal(c, tk)) == NONE)
+    {
+        c->failed = true;
+    }
+
+    if (tk->kind == TK_EOF && !c->failed)
+    {
+        save(c);
+        c->failed = true; // 2 度は書かない
+    }
+}
+
+static bool
+write_all(int fd, const void *p, size_t len)
+{
+    const char *q = (const char*)p;
+    ssize_t r;
+
+    while (len > 0)
+    {
+        if ((r = write(fd, q, len)) <= 0) return false;
+        q += r;
+        len -= r;
+    }
+    return true;
+}
+
+/*
+ * 記録したものを書く. 他のプロセスが書きかけを読まないよう, 一時ファイルに書いて名前を変える.
+ * キャッシュは無くても困らないので, 失敗しても何も言わない.
+ */
+static void
+save(struct TokenCache *c)
+{
+    CacheHeader hd;
+    CachedSym *sym;
+    size_t n = strlen(c->path) + 16;
+    char *tmp;
+    int fd, i;
+    bool ok;
+
+    /* 識別子の表は使った分だけ. 構文解析器が途中で登録した名前も番号を揃えるため含める */
+    sym = (CachedSym*)xmalloc(sizeof(CachedSym)*(c->nsyms + 1));
+    for (i = 0; i < c->nsyms; i++)
+    {
+        sym[i].len = sym_len(c->syms, i);
+        if (!add_text(c, sym_name(c->syms, i), sym[i].len, &sym[i].text))
+        {
+            free(sym);
+            return;
+        }
+    }
+
+    memset(&hd, 0, sizeof(hd));
+    memcpy(hd.magic, CACHE_MAGIC, sizeof(hd.magic));
+    hd.layout = LAYOUT;
+    hd.ntokens = c->nrec;
+    hd.nlits = c->nlits;
+    hd.nsyms = c->nsyms;
+    hd.text_size = c->ntext;
+    hd.hash = c->hash;
+    hd.src_size = c->src_size;
+
+    tmp = (char*)xmalloc(n);
+    snprintf(tmp, n, "%s.XXXXXX", c->path);
+    if ((fd = mkstemp(tmp)) >= 0)
+    {
+        ok = write_all(fd, &hd, sizeof(hd))
+          && write_all(fd, c->rec, sizeof(CachedToken)*c->nrec)
+          && write_all(fd, c->rlits, sizeof(CachedLiteral)*c->nlits)
+          && write_all(fd, sym, sizeof(CachedSym)*c->nsyms)
+          && write_all(fd, c->rtext, c->ntext);
+        fchmod(fd, 0644);
+        close(fd);
+        if (!ok || rename(tmp, c->path) < 0) unlink(tmp);
+    }
+    free(sym);
+    free(tmp);
+}
+
+#ifdef TEST_CACHE
+/*
+ * 壊れたキャッシュファイルを読まないことを確かめる.
+ * 一時ディレクトリに小さなソースのキャッシュを作り, 種類や数値の型を書き換えたものを開く.
+ */
+static const char test_src[] = "int x = 12;\nx = x + 2.5L;\n";
+
+/* bytes をキャッシュファイルに書いて開き, 再生できるかが loads と同じか */
+static bool
+try_load(const char *dir, const char *path, const char *bytes, size_t size, bool loads, const char *what)
+{
+    FILE *f;
+    Intern *syms = make_intern();
+    struct TokenCache *c;
+    bool ok;
+
+    if (!(f = fopen(path, "wb"))) eperror(path);
+    fwrite(bytes, 1, size, f);
+    fclose(f);
+    c = cache_open(dir, test_src, sizeof(test_src) - 1, syms);
+    ok = (c->tokens != NULL) == loads;
+    printf("%-24s %s\n", what, ok ? "ok" : "FAILED");
+    cache_close(c);
+    free_intern(syms);
+    return ok;
+}
+
+int
+main()
+{
+    char dir[] = "/tmp/smash_cache_XXXXXX";
+    char path[64];
+    char *bytes, *bad;
+    size_t size;
+    FILE *f;
+    Lexer *lx;
+    Token tk;
+    const CacheHeader *hd;
+    CachedToken *ct;
+    CachedLiteral *lit;
+    unsigned int i;
+    bool ok = true;
+
+    if (!mkdtemp(dir)) eperror("mkdtemp");
+    lx = make_lexer_mem("test.c", test_src, sizeof(test_src) - 1);
+    lex_use_cache(lx, dir);
+    do lex_token(lx, &tk); while (tk.kind != TK_EOF);
+    free_lexer(lx);
+
+    snprintf(path, sizeof(path), "%s/%016llx.tok", dir, xxh64(test_src, sizeof(test_src) - 1, 0));
+    if (!(f = fopen(path, "rb"))) eperror(path);
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    rewind(f);
+    bytes = (char*)xmalloc(size);
+    bad = (char*)xmalloc(size);
+    if (fread(bytes, 1, size, f) != size) eperror(path);
+    fclose(f);
+    hd = (const CacheHeader*)bytes;
+
+    ok &= try_load(dir, path, bytes, size, true, "intact");
+
+    memcpy(bad, bytes, size);
+    ct = (CachedToken*)(bad + sizeof(CacheHeader));
+    ct[0].kind = 0x7fff0000;
+    ok &= try_load(dir, path, bad, size, false, "kind out of range");
+
+    memcpy(bad, bytes, size);
+    ct = (CachedToken*)(bad + sizeof(CacheHeader));
+    lit = (CachedLiteral*)(ct + hd->ntokens);
+    for (i = 0; i < hd->ntokens && ct[i].kind != TK_NUMBER; i++);
+    if (i == hd->ntokens) eperror("no number in the cache");
+    lit[ct[i].arg].id = 0x7fff0000;
+    ok &= try_load(dir, path, bad, size, false, "number id out of range");
+    lit[ct[i].arg].id = T_STRUCT;
+    ok &= try_load(dir, path, bad, size, false, "number id not a number");
+
+    unlink(path);
+    rmdir(dir);
+    free(bytes);
+    free(bad);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+#endif
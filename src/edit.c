@@ -0,0 +1,966 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <setjmp.h>
+#include "smash.h"
+
+/*
+ * エディタのための差分解析.
+ * Document はソースの複製, トークンの終わりの位置の列とトップレベルの列を持ち,
+ * 編集を受けるたびに壊れたトークンの範囲だけを字句解析し直し, 壊れたトップレベルだけを構文解析し直す.
+ *
+ * 字句解析器はトークンの間で位置のほかに状態を持たない. 編集の後ろで新旧のトークンの終わりが
+ * (編集による長さの差を除いて) 同じ位置に揃えば, そこから先のトークンは変わらない.
+ * トップレベルの構文解析はそれまでのファイルスコープの束縛にだけ依存するので,
+ * 束縛の変わった名前を含まないトップレベルは AST をそのまま使い, 束縛だけを記号表に積み直す.
+ * 束縛がどこも変わっていなければ, 揃ったところから後ろには触らない.
+ *
+ * トークンとトップレベルの列は最後に編集した辺りに隙間を空けておき, 隙間より後ろは
+ * 位置を終わりからの距離で持つ. 記号表も最後に編集した辺りまでの束縛を積んだままにする.
+ * 続けて近くを編集すれば, ファイルの大きさによらず手間は編集した辺りの分だけで済む.
+ *
+ * エラーのあるトップレベルは, 前の解析でのトップレベルの境目まで読み飛ばして続ける.
+ * そのためエラーがあるとき, その後ろは 1 回で全体を読んだ場合 (最初のエラーで止まる) と違う.
+ */
+
+/* 捨てた AST がこれより大きく, 使っている AST より大きくなれば全体を読み直してアリーナを空ける */
+#define GARBAGE_MIN (4 << 20)
+
+typedef struct
+{
+    int first;        // 最初のトークンの添字. 隙間より後ろでは ntokens からの距離
+    int end;          // 次のトップレベルの最初のトークンの添字. 〃
+    int nbinds;       // 積んだファイルスコープの束縛の数
+    Binding *binds;   // その写し. 構文解析器のアリーナに置く
+    Node *node;       // エラーなら NULL
+    char *error;      // エラーの診断. 無ければ NULL
+    size_t bytes;     // AST と束縛の写しに使ったアリーナの大きさ
+} Item;
+
+struct Document
+{
+    const char *name;
+    char *text;
+    size_t len;
+    size_t size;
+    Lexer *lx;
+    Parser *ps;
+    // トークン i は前の空白とコメントを含めて i-1 の終わりから i の終わりまで. 最後は EOF.
+    // 隙間より後ろは終わりの位置をテキストの終わりからの距離で持つ
+    int *ends;
+    int *syms;        // 識別子ならシンボル番号, そうでなければ -1
+    int ntokens;
+    int gap;          // 隙間の前のトークンの数
+    int gap_len;
+    Item *items;
+    int nitems;
+    int igap;
+    int igap_len;
+    int cursor;       // 記号表はトップレベル [0, cursor) の束縛を積んでいる
+    Item *fresh;      // 作り直したトップレベル. 最後に隙間に入れる
+    int nfresh;
+    int fresh_size;
+    Binding *seg;     // 束縛を比べる作業用
+    int seg_size;
+    unsigned char *changed; // シンボル番号 -> 編集の前と束縛が違う
+    int nchanged;
+    int *slot;              // 束縛を比べる作業用. シンボル番号 -> 束縛の添字 + 1
+    int syms_size;
+    size_t live;            // 使っている AST の大きさ
+    size_t garbage;         // 捨てた AST の大きさ
+    int relexed;            // 最後の編集で字句解析したトークンの数
+    int reparsed;           // 〃 構文解析したトップレベルの数
+};
+
+static int  tok_end(const Document *doc, int i);
+static int  tok_sym(const Document *doc, int i);
+static void move_gap(Document *doc, int g);
+static void insert_tokens(Document *doc, const int *ends, const int *syms, int n);
+static Item *item_at(const Document *doc, int i);
+static int  item_first(const Document *doc, int i);
+static int  item_end(const Document *doc, int i);
+static void move_igap(Document *doc, int g);
+static void insert_items(Document *doc, const Item *src, int n);
+static void add_fresh(Document *doc, const Item *it);
+static void define_item(Scope *sc, const Item *it);
+static void move_cursor(Document *doc, int c);
+static void grow_syms(Document *doc);
+static void lex_all(Document *doc);
+static int  find_token(const Document *doc, size_t off);
+static int  find_item(const Document *doc, int t);
+static int  relex(Document *doc, size_t off, size_t n);
+static void diff_bindings(Document *doc, const Binding *a, int na, const Binding *b, int nb);
+static void diff_segment(Document *doc, int from, int to, int sn);
+static int  find_changed(const Document *doc, int first, int end);
+static int  parse_item(Document *doc, int t, int base, Item *it);
+static int  reparse_span(Document *doc, int r, int t, int limit);
+static void reparse(Document *doc, int r, int t, int limit);
+static void parse_all(Document *doc);
+
+/* トークン i の終わりの位置 */
+static int
+tok_end(const Document *doc, int i)
+{
+    return i < doc->gap ? doc->ends[i] : (int)doc->len - doc->ends[i + doc->gap_len];
+}
+
+static int
+tok_sym(const Document *doc, int i)
+{
+    return doc->syms[i < doc->gap ? i : i + doc->gap_len];
+}
+
+/* 隙間をトークン g の前に動かす. 手間は動かした距離の分 */
+static void
+move_gap(Document *doc, int g)
+{
+    int i, n = doc->gap_len, len = doc->len;
+
+    for (i = doc->gap - 1; i >= g; i--)
+    {
+        doc->ends[i + n] = len - doc->ends[i];
+        doc->syms[i + n] = doc->syms[i];
+    }
+    for (i = doc->gap; i < g; i++)
+    {
+        doc->ends[i] = len - doc->ends[i + n];
+        doc->syms[i] = doc->syms[i + n];
+    }
+    doc->gap = g;
+}
+
+/* 隙間に n 個のトークンを入れる. 足りなければ隙間を広げる */
+static void
+insert_tokens(Document *doc, const int *ends, const int *syms, int n)
+{
+    if (doc->gap_len < n)
+    {
+        int tail = doc->ntokens - doc->gap, size = doc->ntokens + doc->gap_len;
+        while (size - doc->ntokens < n) size = size ? size * 2 : 1024;
+        doc->ends = (int*)xrealloc(doc->ends, sizeof(int)*size);
+        doc->syms = (int*)xrealloc(doc->syms, sizeof(int)*size);
+        memmove(doc->ends + size - tail, doc->ends + doc->gap + doc->gap_len, sizeof(int)*tail);
+        memmove(doc->syms + size - tail, doc->syms + doc->gap + doc->gap_len, sizeof(int)*tail);
+        doc->gap_len = size - doc->ntokens;
+    }
+    memcpy(doc->ends + doc->gap, ends, sizeof(int)*n);
+    memcpy(doc->syms + doc->gap, syms, sizeof(int)*n);
+    doc->gap += n;
+    doc->gap_len -= n;
+    doc->ntokens += n;
+}
+
+static Item *
+item_at(const Document *doc, int i)
+{
+    return &doc->items[i < doc->igap ? i : i + doc->igap_len];
+}
+
+static int
+item_first(const Document *doc, int i)
+{
+    return i < doc->igap ? doc->items[i].first : doc->ntokens - doc->items[i + doc->igap_len].first;
+}
+
+static int
+item_end(const Document *doc, int i)
+{
+    return i < doc->igap ? doc->items[i].end : doc->ntokens - doc->items[i + doc->igap_len].end;
+}
+
+/* 隙間をトップレベル g の前に動かす */
+static void
+move_igap(Document *doc, int g)
+{
+    int i, n = doc->igap_len;
+
+    for (i = doc->igap - 1; i >= g; i--)
+    {
+        doc->items[i + n] = doc->items[i];
+        doc->items[i + n].first = doc->ntokens - doc->items[i].first;
+        doc->items[i + n].end = doc->ntokens - doc->items[i].end;
+    }
+    for (i = doc->igap; i < g; i++)
+    {
+        doc->items[i] = doc->items[i + n];
+        doc->items[i].first = doc->ntokens - doc->items[i + n].first;
+        doc->items[i].end = doc->ntokens - doc->items[i + n].end;
+    }
+    doc->igap = g;
+}
+
+static void
+insert_items(Document *doc, const Item *src, int n)
+{
+    if (n == 0) return;
+    if (doc->igap_len < n)
+    {
+        int tail = doc->nitems - doc->igap, size = doc->nitems + doc->igap_len;
+        while (size - doc->nitems < n) size = size ? size * 2 : 256;
+        doc->items = (Item*)xrealloc(doc->items, sizeof(Item)*size);
+        memmove(doc->items + size - tail, doc->items + doc->igap + doc->igap_len, sizeof(Item)*tail);
+        doc->igap_len = size - doc->nitems;
+    }
+    memcpy(doc->items + doc->igap, src, sizeof(Item)*n);
+    doc->igap += n;
+    doc->igap_len -= n;
+    doc->nitems += n;
+}
+
+static void
+add_fresh(Document *doc, const Item *it)
+{
+    if (doc->nfresh >= doc->fresh_size)
+    {
+        doc->fresh_size = doc->fresh_size ? doc->fresh_size * 2 : 64;
+        doc->fresh = (Item*)xrealloc(doc->fresh, sizeof(Item)*doc->fresh_size);
+    }
+    doc->fresh[doc->nfresh++] = *it;
+}
+
+/* トップレベルの束縛を積み直す. 同じ束縛の上では前と同じくすべて受け入れられる */
+static void
+define_item(Scope *sc, const Item *it)
+{
+    int i;
+    for (i = 0; i < it->nbinds; i++) scope_define(sc, it->binds[i].sym, it->binds[i].kind, it->binds[i].type, NULL);
+}
+
+/* 記号表をトップレベル [0, c) の束縛を積んだ状態にする. 手間は動かした距離の分 */
+static void
+move_cursor(Document *doc, int c)
+{
+    Scope *sc = &doc->ps->scope;
+    int i, n = sc->nbindings;
+
+    for (i = doc->cursor - 1; i >= c; i--) n -= item_at(doc, i)->nbinds;
+    scope_rewind(sc, n);
+    for (i = doc->cursor; i < c; i++) define_item(sc, item_at(doc, i));
+    doc->cursor = c;
+}
+
+/* 識別子の表に合わせて changed と slot を広げる */
+static void
+grow_syms(Document *doc)
+{
+    int n = doc->lx->syms->nsyms;
+
+    if (n <= doc->syms_size) return;
+    doc->changed = (unsigned char*)xrealloc(doc->changed, n);
+    doc->slot = (int*)xrealloc(doc->slot, sizeof(int)*n);
+    memset(doc->changed + doc->syms_size, 0, n - doc->syms_size);
+    memset(doc->slot + doc->syms_size, 0, sizeof(int)*(n - doc->syms_size));
+    doc->syms_size = n;
+}
+
+/* 全体を字句解析してトークンの終わりを並べる */
+static void
+lex_all(Document *doc)
+{
+    Token tk;
+    int end, sym;
+
+    doc->gap_len += doc->ntokens;
+    doc->ntokens = doc->gap = 0;
+    lex_seek(doc->lx, doc->text, doc->len, 0);
+    do
+    {
+        lex_token(doc->lx, &tk);
+        end = doc->lx->p - doc->text;
+        sym = tk.kind == TK_IDENT ? tk.sym : -1;
+        insert_tokens(doc, &end, &sym, 1);
+    } while (tk.kind != TK_EOF);
+    doc->relexed = doc->ntokens;
+}
+
+/* 終わりが off より後ろの最初のトークン. 無ければ EOF */
+static int
+find_token(const Document *doc, size_t off)
+{
+    int lo = 0, hi = doc->ntokens - 1;
+
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (tok_end(doc, mid) > (long)off) hi = mid;
+        else                               lo = mid + 1;
+    }
+    return lo;
+}
+
+/* トークン t を含むトップレベル. 最初のトップレベルより前なら 0 */
+static int
+find_item(const Document *doc, int t)
+{
+    int lo = 0, hi = doc->nitems;
+
+    while (hi - lo > 1)
+    {
+        int mid = (lo + hi) / 2;
+        if (item_first(doc, mid) <= t) lo = mid;
+        else                           hi = mid;
+    }
+    return lo;
+}
+
+/*
+ * テキストの off からの n バイトを挿入した後に, 隙間の直後のトークンから読み直す.
+ * 隙間より後ろのトークンの終わりはもう編集の後の位置を指すので, 新しいトークンの終わりが
+ * 編集の後ろでそれと揃ったところで止め, そこまでの古いトークンを新しいもので置き換える.
+ * 置き換えた古いトークンの最後の添字を返す.
+ */
+static int
+relex(Document *doc, size_t off, size_t n)
+{
+    int s = doc->gap, j = s, last = doc->ntokens - 1, nn = 0, size = 64, p;
+    int *ends = (int*)xmalloc(sizeof(int)*size), *syms = (int*)xmalloc(sizeof(int)*size);
+    Token tk;
+
+    lex_seek(doc->lx, doc->text, doc->len, s > 0 ? tok_end(doc, s - 1) : 0);
+    for (;;)
+    {
+        lex_token(doc->lx, &tk);
+        if (nn == size)
+        {
+            ends = (int*)xrealloc(ends, sizeof(int)*(size *= 2));
+            syms = (int*)xrealloc(syms, sizeof(int)*size);
+        }
+        p = doc->lx->p - doc->text;
+        ends[nn] = p;
+        syms[nn++] = tk.kind == TK_IDENT ? tk.sym : -1;
+        if (tk.kind == TK_EOF)
+        {
+            j = last;
+            break;
+        }
+        /* 揃うのは挿入した文字の後ろだけ. EOF は EOF とだけ揃える */
+        if (p < (long)(off + n)) continue;
+        while (j < last && tok_end(doc, j) < p) j++;
+        if (j < last && tok_end(doc, j) == p) break;
+    }
+
+    doc->gap_len += j - s + 1;
+    doc->ntokens -= j - s + 1;
+    insert_tokens(doc, ends, syms, nn);
+    free(ends);
+    free(syms);
+    doc->relexed = nn;
+    return j;
+}
+
+/*
+ * 古い束縛 a と新しい束縛 b を比べ, 違う名前を changed に加える.
+ * ファイルスコープでは同じ名前の束縛は 1 つだけなので, 名前ごとに種類と型を比べればよい.
+ */
+static void
+diff_bindings(Document *doc, const Binding *a, int na, const Binding *b, int nb)
+{
+    int i, k;
+
+    grow_syms(doc);
+    for (i = 0; i < na; i++) doc->slot[a[i].sym] = i + 1;
+    for (i = 0; i < nb; i++)
+    {
+        k = doc->slot[b[i].sym];
+        if (k > 0 && a[k-1].kind == b[i].kind && a[k-1].type == b[i].type)
+        {
+            doc->slot[b[i].sym] = -1;
+        }
+        else if (!doc->changed[b[i].sym])
+        {
+            doc->changed[b[i].sym] = 1;
+            doc->nchanged++;
+        }
+    }
+    for (i = 0; i < na; i++)
+    {
+        if (doc->slot[a[i].sym] > 0 && !doc->changed[a[i].sym])
+        {
+            doc->changed[a[i].sym] = 1;
+            doc->nchanged++;
+        }
+        doc->slot[a[i].sym] = 0;
+    }
+}
+
+/* 古いトップレベル [from, to) の束縛と, 記号表に sn 番目から積んだ新しい束縛を比べる */
+static void
+diff_segment(Document *doc, int from, int to, int sn)
+{
+    Scope *sc = &doc->ps->scope;
+    int i, n = 0;
+
+    for (i = from; i < to; i++) n += item_at(doc, i)->nbinds;
+    if (n > doc->seg_size)
+    {
+        doc->seg_size = n;
+        doc->seg = (Binding*)xrealloc(doc->seg, sizeof(Binding)*n);
+    }
+    for (n = 0, i = from; i < to; i++)
+    {
+        const Item *it = item_at(doc, i);
+        if (it->nbinds) memcpy(doc->seg + n, it->binds, sizeof(Binding)*it->nbinds);
+        n += it->nbinds;
+    }
+    diff_bindings(doc, doc->seg, n, sc->bindings + sn, sc->nbindings - sn);
+}
+
+/* トークン [first, end) で最初の束縛の変わった名前. 無ければ -1 */
+static int
+find_changed(const Document *doc, int first, int end)
+{
+    int i, sym;
+
+    if (doc->nchanged == 0) return -1;
+    for (i = first; i < end; i++)
+    {
+        sym = tok_sym(doc, i);
+        if (sym >= 0 && sym < doc->syms_size && doc->changed[sym]) return i;
+    }
+    return -1;
+}
+
+/*
+ * 字句解析器がトークン base から読んでいるとき, トークン t からトップレベルを 1 つ読む.
+ * 読めれば 1, エラーなら -1 (it->end は読み終えたトークンまで), EOF なら 0 を返す.
+ */
+static int
+parse_item(Document *doc, int t, int base, Item *it)
+{
+    Parser *ps = doc->ps;
+    jmp_buf jb;
+    FILE *err;
+    char *msg = NULL;
+    size_t msg_len = 0, used = arena_used(ps->arena);
+    int mark = ps->scope.nbindings, r;
+
+    it->first = t;
+    it->nbinds = 0;
+    it->binds = NULL;
+    it->error = NULL;
+    it->node = NULL;
+    err = open_memstream(&msg, &msg_len);
+    ps->err = err;
+    ps->on_error = &jb;
+    if (setjmp(jb) == 0)
+    {
+        it->node = read_toplevel(ps);
+        r = it->node ? 1 : 0;
+    }
+    else
+    {
+        r = -1;
+    }
+    ps->on_error = NULL;
+    ps->err = stderr;
+    fclose(err);
+    if (r < 0) it->error = msg;
+    else       free(msg);
+
+    it->end = base + tokens_mark(&ps->ts);
+    if (r > 0 && ps->scope.nbindings > mark)
+    {
+        it->nbinds = ps->scope.nbindings - mark;
+        it->binds = (Binding*)arena_alloc(ps->arena, sizeof(Binding)*it->nbinds);
+        memcpy(it->binds, ps->scope.bindings + mark, sizeof(Binding)*it->nbinds);
+    }
+    it->bytes = arena_used(ps->arena) - used;
+    ps->ntemps = 0;
+    doc->reparsed++;
+    return r;
+}
+
+/*
+ * トークン t から始まるトップレベル r から読み直す. 記号表はその前までの束縛を積み, 隙間は r の前にあること.
+ * 最初のトークンが limit より後ろの古いトップレベルはトークンが変わっていない.
+ * 読み直した列がその境目に揃い, そこが束縛の変わった名前を含まなければ止める.
+ * 作り直した分を隙間に入れ, 揃ったトップレベルの添字を返す. 最後まで読めば -1 を返す.
+ */
+static int
+reparse_span(Document *doc, int r, int t, int limit)
+{
+    Parser *ps = doc->ps;
+    Scope *sc = &ps->scope;
+    Item it;
+    int nold = doc->nitems, m = r, from = r, sn = sc->nbindings, base = 0, mark, i, res;
+    bool seek = true, aligned = false;
+
+    doc->nfresh = 0;
+    while (t < doc->ntokens - 1)
+    {
+        while (m < nold && item_first(doc, m) < t) m++;
+        if (m < nold && item_first(doc, m) == t && t > limit)
+        {
+            /* 前に揃ったところからの束縛の違い */
+            diff_segment(doc, from, m, sn);
+            if ((aligned = find_changed(doc, t, item_end(doc, m)) < 0)) break;
+            from = m;
+            sn = sc->nbindings;
+        }
+
+        if (seek)
+        {
+            lex_seek(doc->lx, doc->text, doc->len, t > 0 ? tok_end(doc, t - 1) : 0);
+            parser_restart(ps, sc->nbindings);
+            base = t;
+            seek = false;
+        }
+        mark = sc->nbindings;
+        if ((res = parse_item(doc, t, base, &it)) == 0) break;
+        if (res < 0)
+        {
+            /* 前の解析の次の境目まで読み飛ばす. 無ければ最後まで */
+            for (i = m; i < nold && (item_first(doc, i) <= limit || item_first(doc, i) < it.end); i++);
+            it.end = i < nold ? item_first(doc, i) : doc->ntokens - 1;
+            if (it.end <= t) it.end = t + 1;
+            parser_restart(ps, mark);
+            seek = true;
+        }
+        doc->live += it.bytes;
+        add_fresh(doc, &it);
+        t = it.end;
+    }
+    if (!aligned) m = nold;
+
+    /* 古い [r, m) を捨てて作り直した列を入れる */
+    for (i = r; i < m; i++)
+    {
+        Item *old = item_at(doc, i);
+        doc->live -= old->bytes;
+        doc->garbage += old->bytes;
+        free(old->error);
+    }
+    doc->igap_len += m - r;
+    doc->nitems -= m - r;
+    insert_items(doc, doc->fresh, doc->nfresh);
+    doc->cursor = doc->igap;
+    return aligned ? doc->igap : -1;
+}
+
+/*
+ * reparse_span で読み直し, 束縛が変わっていれば, その名前を使うトップレベルを探して読み直すのを繰り返す.
+ * 間のトップレベルはそのまま使い, 記号表と隙間を動かすだけで飛ばす.
+ */
+static void
+reparse(Document *doc, int r, int t, int limit)
+{
+    int k, m;
+
+    grow_syms(doc);
+    if (doc->syms_size) memset(doc->changed, 0, doc->syms_size);
+    doc->nchanged = 0;
+    while ((r = reparse_span(doc, r, t, limit)) >= 0)
+    {
+        if ((k = find_changed(doc, item_first(doc, r), doc->ntokens - 1)) < 0) break;
+        /* 1 つ前のトップレベルも終わりの後ろを覗いているので, トークン k-2 を含むものから読む */
+        m = find_item(doc, k);
+        if ((k = find_item(doc, k > 2 ? k - 2 : 0)) > r) r = k;
+        move_cursor(doc, r);
+        move_igap(doc, r);
+        t = item_first(doc, r);
+        limit = item_first(doc, m);
+    }
+}
+
+/* 構文解析器を作り直して全体を読む */
+static void
+parse_all(Document *doc)
+{
+    int i;
+
+    for (i = 0; i < doc->nitems; i++) free(item_at(doc, i)->error);
+    doc->igap_len += doc->nitems;
+    doc->nitems = doc->igap = doc->cursor = 0;
+    doc->live = doc->garbage = 0;
+    doc->reparsed = 0;
+    if (doc->ps) free_parser(doc->ps);
+    doc->ps = make_parser(doc->lx);
+    reparse(doc, 0, 0, -1);
+}
+
+/*
+ * name という名前のソース text の len バイトを複写して全体を解析する.
+ * 大きすぎて位置を int で表せなければ NULL を返す.
+ */
+Document *
+make_document(const char *name, const char *text, size_t len)
+{
+    Document *doc;
+
+    if (len >= INT_MAX) return NULL;
+    doc = (Document*)xcalloc(1, sizeof(Document));
+    doc->name = name;
+    doc->size = len + 1;
+    doc->text = (char*)xmalloc(doc->size);
+    memcpy(doc->text, text, len);
+    doc->len = len;
+    doc->lx = make_lexer_mem(name, doc->text, len);
+    lex_all(doc);
+    parse_all(doc);
+    return doc;
+}
+
+void
+free_document(Document *doc)
+{
+    int i;
+
+    for (i = 0; i < doc->nitems; i++) free(item_at(doc, i)->error);
+    free(doc->items);
+    free(doc->fresh);
+    free(doc->seg);
+    free_parser(doc->ps);
+    free_lexer(doc->lx);
+    free(doc->text);
+    free(doc->ends);
+    free(doc->syms);
+    free(doc->changed);
+    free(doc->slot);
+    free(doc);
+}
+
+/*
+ * テキストの offset から del バイトを ins の len バイトで置き換え, 解析結果を更新する.
+ * 変わらなかったトップレベルは前と同じ Node を返す. 範囲が正しくなければ何もせず false を返す.
+ */
+bool
+doc_edit(Document *doc, size_t offset, size_t del, const char *ins, size_t len)
+{
+    int k, s, r, t, j, ntokens = doc->ntokens;
+
+    if (offset > doc->len || del > doc->len - offset) return false;
+    if (doc->len - del + len >= INT_MAX) return false;
+
+    /*
+     * offset にかかる最初のトークンを k とする. 字句解析器は LEX_LOOKAHEAD 文字先まで覗き,
+     * トークンは 1 文字以上あるので, k の前の LEX_LOOKAHEAD 個のトークンも offset の先を見て決まったかもしれない.
+     * そこで s = k - LEX_LOOKAHEAD から字句解析し直す. 構文解析器はトップレベルの終わりから 2 トークン先までを覗くので,
+     * トークン s - 2 を含むトップレベルから読み直す. 隙間と記号表をそこへ動かしてから編集する.
+     */
+    k = find_token(doc, offset);
+    s = k > LEX_LOOKAHEAD ? k - LEX_LOOKAHEAD : 0;
+    r = find_item(doc, s > 2 ? s - 2 : 0);
+    t = r < doc->nitems ? item_first(doc, r) : 0;
+    move_cursor(doc, r);
+    move_igap(doc, r);
+    move_gap(doc, s);
+
+    if (doc->len - del + len >= doc->size)
+    {
+        while (doc->len - del + len >= doc->size) doc->size *= 2;
+        doc->text = (char*)xrealloc(doc->text, doc->size);
+    }
+    memmove(doc->text + offset + len, doc->text + offset + del, doc->len - offset - del);
+    memcpy(doc->text + offset, ins, len);
+    doc->len = doc->len - del + len;
+
+    j = relex(doc, offset, len);
+    doc->reparsed = 0;
+    reparse(doc, r, t, j + doc->ntokens - ntokens);
+
+    if (doc->garbage > GARBAGE_MIN && doc->garbage > doc->live)
+    {
+        /* 字句の複製も溜まっているので字句解析器ごと作り直す */
+        free_parser(doc->ps);
+        doc->ps = NULL;
+        free_lexer(doc->lx);
+        doc->lx = make_lexer_mem(doc->name, doc->text, doc->len);
+        doc->syms_size = 0;
+        lex_all(doc);
+        parse_all(doc);
+    }
+    return true;
+}
+
+/* 今のテキスト */
+const char *
+doc_text(const Document *doc, size_t *len)
+{
+    *len = doc->len;
+    return doc->text;
+}
+
+int
+doc_items(const Document *doc)
+{
+    return doc->nitems;
+}
+
+/* i 番目のトップレベル. エラーなら NULL を返し, error に診断を入れる */
+Node *
+doc_item(const Document *doc, int i, const char **error)
+{
+    Item *it = item_at(doc, i);
+    if (error) *error = it->error;
+    return it->node;
+}
+
+/* 最後の編集で字句解析したトークンと構文解析したトップレベルの数 */
+void
+doc_counts(const Document *doc, int *relexed, int *reparsed)
+{
+    *relexed = doc->relexed;
+    *reparsed = doc->reparsed;
+}
+
+#ifdef BENCH_EDIT
+/*
+ * キーを打つたびの差分解析の時間を測る. ファイルの中の行の頭 POINTS か所で
+ * TYPED を 1 文字ずつ打ち, 1 文字ずつ消す. 打ち終えたときと最後に, 初めから解析した結果と比べる.
+ * 続けてファイルの先頭 RANDOM_BYTES ほどの行で, ランダムな位置を消して PIECES のどれかを挿入するのを
+ * RANDOM_EDITS 回繰り返し, 毎回初めから解析した結果と比べる. 時間は測らない.
+ * 人向けの結果を stderr に, 1 ファイル 1 行の JSON を stdout に書く.
+ */
+#define POINTS 200
+#define TYPED  "zz = zz + 1;\n"
+#define RANDOM_EDITS 1000
+#define RANDOM_BYTES 65536
+
+/* 字句の境目を動かしやすい断片 */
+static const char *const pieces[] =
+{
+    ".", "..", "x", "1", "e", "+", "-", "=", "<", ">", "/", "*", "/*", "*/",
+    "\\\n", " ", "\n", ";", "\"", "'", "{", "}", "(", ")",
+};
+
+static unsigned long long rand_state = 88172645463325252ULL;
+
+static unsigned long long
+xorshift()
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* トークンの終わりの位置と識別子の名前が同じか */
+static bool
+same_tokens(const Document *a, const Document *b)
+{
+    int i, x, y;
+
+    if (a->ntokens != b->ntokens) return false;
+    for (i = 0; i < a->ntokens; i++)
+    {
+        if (tok_end(a, i) != tok_end(b, i)) return false;
+        x = tok_sym(a, i);
+        y = tok_sym(b, i);
+        if ((x < 0) != (y < 0)) return false;
+        if (x >= 0 && strcmp(sym_name(a->lx->syms, x), sym_name(b->lx->syms, y)) != 0) return false;
+    }
+    return true;
+}
+
+/*
+ * 2 つの木が同じか. 種類, 子, 子の列, 値を比べる.
+ * シンボルの番号は文書ごとに違うので名前で比べる.
+ */
+static bool
+same_tree(const Ast *t1, const Intern *s1, const Ast *t2, const Intern *s2)
+{
+    AstRef r;
+
+    if (t1->len != t2->len || t1->nlist != t2->nlist) return false;
+    if (memcmp(t1->kind, t2->kind, sizeof(t1->kind[0])*t1->len) != 0) return false;
+    if (t1->nlist && memcmp(t1->list, t2->list, sizeof(AstRef)*t1->nlist) != 0) return false;
+    for (r = 1; r < t1->len; r++)
+    {
+        if (t1->c[r] != t2->c[r]) return false;
+        switch (t1->kind[r])
+        {
+            case AST_IDENT:
+            case KEY_GOTO:
+            case AST_LABEL:
+            case AST_LVAR:
+                if (t1->b[r] != t2->b[r]) return false;
+                if (strcmp(sym_name(s1, t1->a[r]), sym_name(s2, t2->a[r])) != 0) return false;
+                break;
+            case '.':
+                if (t1->a[r] != t2->a[r]) return false;
+                if (strcmp(sym_name(s1, t1->b[r]), sym_name(s2, t2->b[r])) != 0) return false;
+                break;
+            case AST_STRING:
+            case AST_CHAR:
+                if (t1->str[t1->a[r]]->len != t2->str[t2->a[r]]->len) return false;
+                if (memcmp(t1->str[t1->a[r]]->str, t2->str[t2->a[r]]->str, t1->str[t1->a[r]]->len) != 0) return false;
+                break;
+            default:
+                if (t1->a[r] != t2->a[r] || t1->b[r] != t2->b[r]) return false;
+                break;
+        }
+    }
+    return true;
+}
+
+/*
+ * 初めから解析した結果とトークンの列とトップレベルごとの木が同じか.
+ * 初めから読むと最初のエラーで止まるので, 木はエラーの前までを比べる.
+ */
+static bool
+same_as_fresh(Document *doc, Ast *t1, Ast *t2)
+{
+    Document *fresh;
+    size_t len;
+    const char *text = doc_text(doc, &len);
+    bool same;
+    int i, n;
+
+    fresh = make_document(doc->name, text, len);
+    n = doc_items(fresh);
+    if (n > 0 && !doc_item(fresh, n - 1, NULL)) same = doc_items(doc) >= n--;
+    else                                        same = doc_items(doc) == n;
+    if (!same_tokens(doc, fresh)) same = false;
+    for (i = 0; same && i < n; i++)
+    {
+        Node *a = doc_item(doc, i, NULL), *b = doc_item(fresh, i, NULL);
+        if (!a)
+        {
+            same = false;
+            break;
+        }
+        ast_clear(t1);
+        ast_clear(t2);
+        ast_from_node(t1, a);
+        ast_from_node(t2, b);
+        same = same_tree(t1, doc->lx->syms, t2, fresh->lx->syms);
+    }
+    free_document(fresh);
+    return same;
+}
+
+/*
+ * src の先頭 RANDOM_BYTES ほどの行で文書を作り, ランダムに編集しては初めから解析した結果と比べる.
+ * 打つときのように半分は前に挿入した断片のすぐ後ろ, 4 分の 1 はその近くを選ぶ. 違えばその編集を stderr に書いて false
+ */
+static bool
+random_edits(const char *name, const char *src, size_t len, Ast *t1, Ast *t2, long *nedits)
+{
+    Document *doc;
+    size_t off = 0, dl, del;
+    const char *ins = "";
+    bool ok = true;
+    long i;
+
+    if (len > RANDOM_BYTES)
+    {
+        for (len = RANDOM_BYTES; len > 0 && src[len-1] != '\n'; len--);
+    }
+    doc = make_document(name, src, len);
+    for (i = 0; ok && i < RANDOM_EDITS; i++)
+    {
+        doc_text(doc, &dl);
+        switch (xorshift() % 4)
+        {
+        case 0:  off = xorshift() % (dl + 1); break;
+        case 1:  off = off > 4 ? off - 4 + xorshift() % 9 : xorshift() % 9; break;
+        default: off += i > 0 ? strlen(ins) : 0; break;
+        }
+        if (off > dl) off = dl;
+        del = xorshift() % 4 == 0 ? xorshift() % 3 : 0;
+        if (del > dl - off) del = dl - off;
+        ins = pieces[xorshift() % (sizeof(pieces)/sizeof(pieces[0]))];
+        doc_edit(doc, off, del, ins, strlen(ins));
+        if (!same_as_fresh(doc, t1, t2))
+        {
+            fprintf(stderr, "random edit %ld: offset %zu, delete %zu, insert %zu bytes differs from a fresh parse\n",
+                    i, off, del, strlen(ins));
+            ok = false;
+        }
+    }
+    *nedits = i;
+    free_document(doc);
+    return ok;
+}
+
+int
+main(int argc, char *argv[])
+{
+    FILE *f;
+    char *src;
+    size_t len, size = 1 << 16;
+    size_t *lines;
+    Document *doc;
+    Ast *t1 = make_ast_tree(), *t2 = make_ast_tree();
+    Clock start, end;
+    double *times, load, sum = 0;
+    long nedits = 0, relexed = 0, reparsed = 0, nrandom;
+    int nlines = 0, lines_size = 1024, i, k, nt, np;
+    size_t typed = strlen(TYPED);
+    bool ok = true;
+
+    if (argc < 2) exit(EXIT_FAILURE);
+    if (!(f = fopen(argv[1], "r"))) eperror(argv[1]);
+    src = (char*)xmalloc(size);
+    for (len = 0; (k = fread(src + len, 1, size - len, f)) > 0;)
+    {
+        len += k;
+        if (len == size) src = (char*)xrealloc(src, size *= 2);
+    }
+    fclose(f);
+
+    lines = (size_t*)xmalloc(sizeof(size_t)*lines_size);
+    for (i = 0; i < (int)len; i++)
+    {
+        if (i > 0 && src[i-1] != '\n') continue;
+        if (nlines == lines_size) lines = (size_t*)xrealloc(lines, sizeof(size_t)*(lines_size *= 2));
+        lines[nlines++] = i;
+    }
+    if (nlines == 0) exit(EXIT_FAILURE);
+
+    stats_clock(&start);
+    doc = make_document(argv[1], src, len);
+    stats_clock(&end);
+    if (!doc) exit(EXIT_FAILURE);
+    load = end.wall - start.wall;
+
+    times = (double*)xmalloc(sizeof(double)*POINTS*typed*2);
+    for (i = 0; i < POINTS; i++)
+    {
+        size_t off = lines[xorshift() % nlines];
+
+        for (k = 0; k < (int)typed * 2; k++)
+        {
+            stats_clock(&start);
+            if (k < (int)typed) doc_edit(doc, off + k, 0, TYPED + k, 1);
+            else                doc_edit(doc, off + typed * 2 - k - 1, 1, "", 0);
+            stats_clock(&end);
+            times[nedits] = end.wall - start.wall;
+            sum += times[nedits++];
+            doc_counts(doc, &nt, &np);
+            relexed += nt;
+            reparsed += np;
+            if (k == (int)typed - 1 && !same_as_fresh(doc, t1, t2)) ok = false;
+        }
+    }
+    if (!same_as_fresh(doc, t1, t2)) ok = false;
+    if (!random_edits(argv[1], src, len, t1, t2, &nrandom)) ok = false;
+    qsort(times, nedits, sizeof(double), cmp_double);
+
+    fprintf(stderr, "edit   %-24s %8d items %10.3f ms load %8.3f ms mean %8.3f ms p99 %8.3f ms max %s\n",
+            argv[1], doc_items(doc), load * 1e3, sum / nedits * 1e3, times[nedits * 99 / 100] * 1e3,
+            times[nedits-1] * 1e3, ok ? "" : "MISMATCH");
+    printf("{\"bench\": \"edit\", \"file\": \"%s\", \"items\": %d, \"edits\": %ld, \"load_ms\": %.3f, "
+           "\"mean_ms\": %.6f, \"p99_ms\": %.6f, \"max_ms\": %.6f, \"relexed_per_edit\": %.1f, "
+           "\"reparsed_per_edit\": %.2f, \"random_edits\": %ld, \"same\": %s, \"peak_rss_kb\": %ld}\n",
+           argv[1], doc_items(doc), nedits, load * 1e3, sum / nedits * 1e3, times[nedits * 99 / 100] * 1e3,
+           times[nedits-1] * 1e3, (double)relexed / nedits, (double)reparsed / nedits,
+           nrandom, ok ? "true" : "false", peak_rss());
+
+    free_document(doc);
+    free_ast_tree(t1);
+    free_ast_tree(t2);
+    free(times);
+    free(lines);
+    free(src);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+#endif
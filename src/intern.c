@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "smash.h"
+
+/*
+ * 識別子の名前を一意な番号 (シンボル) に対応付ける.
+ * 表はオープンアドレス法で, 名前の実体は表ごとのアリーナに置く.
+ * 番号は表ごとに振るので, 別の表のシンボルと比べてはならない.
+ */
+
+static unsigned int hash_bytes(const char *str, int len);
+static void rehash(Intern *t);
+
+static unsigned int
+hash_bytes(const char *str, int len)
+{
+    unsigned int h = 2166136261u;
+    int i;
+    for (i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)str[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void
+rehash(Intern *t)
+{
+    int i, j, mask;
+    free(t->table);
+    t->table_size = t->table_size ? t->table_size * 2 : 1024;
+    t->table = (int*)xcalloc(t->table_size, sizeof(int));
+    mask = t->table_size - 1;
+    for (i = 0; i < t->nsyms; i++)
+    {
+        for (j = t->syms[i].hash & mask; t->table[j]; j = (j + 1) & mask);
+        t->table[j] = i + 1;
+    }
+}
+
+Intern *
+make_intern()
+{
+    Intern *t = (Intern*)xcalloc(1, sizeof(Intern));
+    t->pool = make_arena();
+    return t;
+}
+
+void
+free_intern(Intern *t)
+{
+    free(t->syms);
+    free(t->table);
+    free_arena(t->pool);
+    free(t);
+}
+
+int
+intern(Intern *t, const char *str, int len)
+{
+    unsigned int h = hash_bytes(str, len);
+    int i, mask;
+    char *name;
+
+    if (t->nsyms * 2 >= t->table_size) rehash(t);
+    mask = t->table_size - 1;
+    for (i = h & mask; t->table[i]; i = (i + 1) & mask)
+    {
+        Symbol *s = &t->syms[t->table[i]-1];
+        if (s->hash == h && s->len == len && memcmp(s->name, str, len) == 0)
+        {
+            return t->table[i] - 1;
+        }
+    }
+
+    if (t->nsyms >= t->syms_size)
+    {
+        t->syms_size = t->syms_size ? t->syms_size * 2 : 1024;
+        t->syms = (Symbol*)xrealloc(t->syms, sizeof(Symbol)*t->syms_size);
+    }
+    name = (char*)arena_alloc(t->pool, len + 1);
+    memcpy(name, str, len);
+    name[len] = '\0';
+    t->syms[t->nsyms].name = name;
+    t->syms[t->nsyms].len = len;
+    t->syms[t->nsyms].hash = h;
+    t->table[i] = ++t->nsyms;
+    return t->nsyms - 1;
+}
+
+const char *
+sym_name(const Intern *t, int sym)
+{
+    return t->syms[sym].name;
+}
+
+int
+sym_len(const Intern *t, int sym)
+{
+    return t->syms[sym].len;
+}
@@ -1,397 +1,230 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <ctype.h>
 #include <string.h>
-#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "smash.h"
+#include "lex_table.inc"
 
-static FILE *file = NULL;
+/* EOF は (unsigned char) で 255 になり, どの分類にも属さない */
+#define CLASS(c) char_class[(unsigned char)(c)]
 
-static int *stack;
-static int stack_p;
-static int stack_size;
+/* ストリームはおよそ STREAM_BLOCK バイトずつ, STREAM_READ バイトずつの read で読む */
+#define STREAM_BLOCK (64*1024)
+#define STREAM_READ  (16*1024)
+
+/*
+ * ストリームから読んだソースの一区切り. 継続行でない改行の直後で切るので,
+ * ブロックをまたぐのはブロックコメントだけで, トークンはまたがない.
+ */
+typedef struct LexBlock
+{
+    struct LexBlock *next;   // 1 つ古いブロック
+    unsigned long expire;    // トークンの数がここまで進めば, このブロックを指すトークンは無い
+    char text[];
+} LexBlock;
+
+typedef struct LexStream
+{
+    int fd;
+    bool eof;
+    char *buf;               // 読んだが, まだブロックにしていないバイト
+    size_t len;
+    size_t size;
+    LexBlock *cur;           // 今読んでいるブロック
+    LexBlock *old;           // 読み終えたブロック. 新しい順
+    unsigned long ntokens;   // 読んだトークンの数
+} LexStream;
 
 /* prototype */
-static void  stack_push(int c);
-static int   stack_pop();
-static int   stack_count();
-static Token *make_invalid();
-static Token *make_eof();
-static Token *make_pnct(int c);
-static Token *make_ident(int c);
-static Token *make_number(int c);
-static bool  make_number_base(int c, int base, String *p, int *t);
-static bool  make_float_base(int c, int base, String *p, int *t);
-static int   char2int(char c);
-static void  conv_number(Token *tk, int base);
-static Token *make_string_literal();
-static Token *make_char_literal();
+static Token *new_token(Lexer *lx);
+static void  make_invalid(Token *tk);
+static void  make_eof(Token *tk);
+static void  make_pnct(Token *tk, int c);
+static void  set_text(Lexer *lx, Token *tk, const char *start);
+static void  make_ident(Lexer *lx, Token *tk);
+static void  make_number(Lexer *lx, Token *tk);
+static void  make_literal(Lexer *lx, Token *tk, int kind, int quote);
 //static bool  is_simple_escape(int c);
 static bool  is_nondigit(int c);
 static bool  is_digit(int c, int base);
-static bool  is_space(int c);
 static bool  is_return(int c);
 static void  set_keyword(Token *tk);
-static void  skip();
-static bool  estimate(int x);
-static bool  estimate2(int x, int y);
-static int   peek_char();
-static void  unread_char(int c);
-static int   read_char();
+static void  skip(Lexer *lx);
+static int   read_pnct(Lexer *lx);
+static bool  estimate(Lexer *lx, int x);
+static const char *skip_splice(Lexer *lx, const char *q);
+static void  seek(Lexer *lx, const char *q);
+static const char *advance(Lexer *lx, const char *q);
+static int   peek_char(Lexer *lx);
+static int   peek_char2(Lexer *lx);
+static int   read_char(Lexer *lx);
+static size_t line_end(const char *buf, size_t len);
+static void  free_blocks(LexBlock *b);
+static bool  refill(Lexer *lx);
+static Lexer *new_lexer(const char *path);
+static void  set_source(Lexer *lx, const char *src, size_t len);
 
-static void
-stack_push(int c)
+static Token *
+new_token(Lexer *lx)
 {
-    if (stack_p >= stack_size)
+    Token *tk = lx->free_tokens;
+    if (tk)
     {
-        stack = (int*)realloc(stack, sizeof(int)*stack_size*2);
-        stack_size *= 2;
+        lx->free_tokens = *(Token**)tk;
+        return tk;
     }
-    stack[stack_p++] = c;
+    return (Token*)arena_alloc(lx->arena, sizeof(Token));
 }
 
-static int
-stack_pop()
-{
-    assert(stack_p > 0);
-    return stack[--stack_p];
-}
-
-static int
-stack_count() { return stack_p; }
-
-static Token *
-make_invalid()
+static void
+make_invalid(Token *tk)
 {
-    Token *tk = (Token*)malloc(sizeof(Token));
     tk->kind = TK_INVALID;
-    tk->str = NULL;
-    return tk;
+    tk->text = NULL;
+    tk->len = 0;
 }
 
-static Token *
-make_eof()
+static void
+make_eof(Token *tk)
 {
-    Token *tk = (Token*)malloc(sizeof(Token));
     tk->kind = TK_EOF;
-    tk->str = NULL;
-    return tk;
+    tk->text = NULL;
+    tk->len = 0;
 }
 
-static Token *
-make_pnct(int c)
+static void
+make_pnct(Token *tk, int c)
 {
-    Token *tk = (Token*)malloc(sizeof(Token));
     tk->kind = c;
-    tk->str = NULL;
-    return tk;
+    tk->text = NULL;
+    tk->len = 0;
 }
 
-static Token *
-make_ident(int c)
+/*
+ * p まで読んだ字句を start から設定する. 行継続をまたいでいなければ
+ * ソースをそのまま指し, またいでいれば行継続を除いた複製を作る.
+ */
+static void
+set_text(Lexer *lx, Token *tk, const char *start)
 {
-    Token *tk;
-    char buf[128];
-    int p;
+    const char *q;
+    char *d;
 
-    tk = (Token*)malloc(sizeof(Token));
-    tk->kind = TK_IDENT;
-    tk->str = make_string("");
-    for (p = 0; is_digit(c, 10) || is_nondigit(c); p++, c = read_char())
+    if (!lx->spliced)
     {
-        if (p == 128-1)
-        {
-            buf[p] = '\0';
-            append_chars(tk->str, buf);
-            p = 0;
-        }
-        buf[p] = c;
+        tk->text = start;
+        tk->len = lx->p - start;
+        return;
     }
-    buf[p] = '\0';
-    append_chars(tk->str, buf);
-    unread_char(c);
-
-    set_keyword(tk);
-    return tk;
-}
 
-static Token *
-make_number(int c)
-{
-    int base;
-    Token *tk;
-    tk = (Token*)malloc(sizeof(Token));
-    tk->kind = TK_NUMBER;
-    tk->str = make_string("");
-
-    if (c == '0')
-    {
-        c = read_char();
-        if (c == 'x' || c == 'X')
-        {
-            base = 16;
-            append_chars(tk->str, "0x");
-            make_number_base(read_char(), 16, tk->str, &(tk->id));
-        }
-        else
-        {
-            base = 8;
-            append_chars(tk->str, "0");
-            make_number_base(read_char(), 8, tk->str, &(tk->id));
-        }
-    }
-    else
+    tk->text = d = (char*)arena_alloc(lx->arena, lx->p - start + 1);
+    for (q = start; q < lx->p; )
     {
-        base = 10;
-        make_number_base(c, 10, tk->str, &(tk->id));
+        if (q[0] == '\\' && q+1 < lx->p && q[1] == '\n') q += 2;
+        else *d++ = *q++;
     }
-    conv_number(tk, base);
-    free_string(tk->str);
-    return tk;
+    *d = '\0';
+    tk->len = d - tk->text;
 }
 
-static bool
-make_number_base(int c, int base, String *p, int *t)
+static void
+make_ident(Lexer *lx, Token *tk)
 {
-    for (; is_digit(c, base); c = read_char())
-    {
-        append_char(p, c);
-    }
+    const char *start = lx->p, *q = lx->p;
 
-    if (c == '.' || c == 'e' || c == 'E' || c == 'p' || c == 'P')
-    {
-        return make_float_base(c, (base == 16) ? 16 : 10, p, t);
-    }
+    tk->kind = TK_IDENT;
 
-    if (c == 'u' || c == 'U')
-    {
-        append_chars(p, "u");
-        if (estimate2('l', 'l') || estimate2('L', 'L'))
-        {
-            append_chars(p, "ll");
-            *t = T_ULLINT;
-        }
-        else if (estimate('l') || estimate('L'))
-        {
-            append_chars(p, "l");
-            *t = T_ULINT;
-        }
-        else
-        {
-            *t = T_UINT;
-        }
-    }
-    else
-    {
-        unread_char(c);
-        if (estimate2('l', 'l') || estimate2('L', 'L'))
-        {
-            append_chars(p, "ll");
-            *t = T_LLINT;
-        }
-        else if (estimate('l') || estimate('L'))
-        {
-            append_chars(p, "l");
-            *t = T_LINT;
-        }
-        else
-        {
-            *t = T_INT;
-        }
-    }
-    return true;
+    while (q < lx->src_end && (CLASS(*q) & (CC_NONDIGIT | CC_DIGIT))) q++;
+    seek(lx, q);
+    /* 行継続の後にも識別子が続いている */
+    while (is_digit(peek_char(lx), 10) || is_nondigit(peek_char(lx))) read_char(lx);
+    set_text(lx, tk, start);
+
+    set_keyword(tk);
+    if (tk->kind == TK_IDENT) tk->sym = intern(lx->syms, tk->text, tk->len);
 }
 
-static bool
-make_float_base(int c, int base, String *p, int *t)
+/*
+ * 数値リテラル. 行継続をまたがなければソースの上で直接変換し,
+ * またぐ場合と不正なリテラルの場合は行継続を除いた前処理数を読み直す.
+ */
+static void
+make_number(Lexer *lx, Token *tk)
 {
-    if (c == '.')
+    const char *q, *start = lx->p;
+    StringBuf sb;
+    int c, prev;
+
+    tk->kind = TK_NUMBER;
+
+    q = scan_number(lx->p, lx->src_end, tk);
+    if (q && !(q < lx->src_end && *q == '\\' && skip_splice(lx, q) != q))
     {
-        append_char(p, c);
-        c = read_char();
-        if (is_digit(c, 10))
-        {
-            for (; is_digit(c, 10); c = read_char())
-            {
-                append_char(p, c);
-            }
-        }
+        tk->text = start;
+        tk->len = q - start;
+        seek(lx, q);
+        return;
     }
 
-    if (c == 'p' || c == 'P' || c == 'e' || c == 'E')
+    sbuf_init(&sb);
+    for (prev = 0; (c = peek_char(lx)) != EOF; prev = c)
     {
-        if (base == 10 && (c == 'p' || c == 'P'))
-        {
-            // error
-            assert(0);
-        }
-        else if (base == 16 && (c == 'e' || c == 'E'))
-        {
-            // error
-            assert(0);
-        }
-        append_char(p, c);
-        c = read_char();
-        if (c == '+' || c == '-')
-        {
-            append_char(p, c);
-            c = read_char();
-        }
-        
-        for (; is_digit(c, 10); c = read_char())
+        if (!is_digit(c, 10) && !is_nondigit(c) && c != '.'
+         && !((c == '+' || c == '-') && (prev == 'e' || prev == 'E' || prev == 'p' || prev == 'P')))
         {
-            append_char(p, c);
+            break;
         }
+        sbuf_append_char(&sb, read_char(lx));
     }
 
-    if (c == 'f' || c == 'F')
+    if ((q = scan_number(sb.str, sb.str + sb.len, tk)))
     {
-        *t = T_FLOAT;
-        append_char(p, c);
-    }
-    else if (c == 'l' || c == 'L')
-    {
-        *t = T_LDOUBLE;
-        append_char(p, c);
+        /* 前処理数のうち数値リテラルでない部分は読まなかったことにする */
+        for (lx->p = start, c = q - sb.str; c > 0; c--) read_char(lx);
+        sb.len = q - sb.str;
     }
     else
     {
-        *t = T_DOUBLE;
-        unread_char(c);
-    }
-    return true;
-}
-
-static int
-char2int(char c)
-{
-    if ('a' <= c && c <= 'f') return c - 'a' + 10;
-    if ('A' <= c && c <= 'F') return c - 'A' + 10;
-    return c - '0';
-}
-
-#define str2int(type, m, base) \
-    do { \
-        const char *str = string2char(tk->str); \
-        type val = 0; \
-        for ( ; is_digit(*str, base); str++) \
-        { \
-            val *= (type)base; \
-            val += (type)char2int(*str); \
-        } \
-        tk->m = val; \
-        return; \
-    } while (0)
-
-static void
-conv_number(Token *tk, int base)
-{
-    switch (tk->id)
-    {
-        case T_INT:
-            str2int(int, i, base);
-        case T_LINT:
-            str2int(long int, li, base);
-        case T_LLINT:
-            str2int(long long int, lli, base);
-        case T_UINT:
-            str2int(unsigned int, ui, base);
-        case T_ULINT:
-            str2int(unsigned long int, uli, base);
-        case T_ULLINT:
-            str2int(unsigned long long int, ulli, base);
-        case T_FLOAT:
-        case T_DOUBLE:
-        case T_LDOUBLE:
-            break;
+        tk->kind = TK_INVALID;
     }
+    tk->text = sbuf_to_arena(&sb, lx->arena)->str;
+    tk->len = sb.len;
+    sbuf_free(&sb);
 }
 
-#undef str2int
-
-/*
+/* 引用符で囲まれた文字列・文字リテラル. 字句は引用符とエスケープをそのまま含む */
 static void
-str2float(Token *tk, int base)
-{
-    do
-    {
-        const char *str = string2char(tk->str);
-        double val = 0.0;
-        for ( ; is_digit(*str, base); str++)
-        {
-        }
-    } while (0);
-}
-*/
-
-static Token *
-make_string_literal()
-{
-    Token *tk;
-    int c;
-
-    tk = (Token*)malloc(sizeof(Token));
-    tk->kind = TK_STRING;
-    tk->str = make_string("\"");
-
-    for (;;)
-    {
-        c = read_char();
-        if (is_return(c))
-        {
-            // error
-            assert(0);
-            return NULL;
-        }
-        else if (c == '"')
-        {
-            append_chars(tk->str, "\"");
-            return tk;
-        }
-        else if (c == '\\')
-        {
-            append_char(tk->str, c);
-            append_char(tk->str, read_char());
-        }
-        else
-        {
-            append_char(tk->str, c);
-        }
-    }
-}
-
-static Token *
-make_char_literal()
+make_literal(Lexer *lx, Token *tk, int kind, int quote)
 {
-    Token *tk;
+    const char *start = lx->p;
     int c;
 
-    tk = (Token*)malloc(sizeof(Token));
-    tk->kind = TK_CHAR;
-    tk->str = make_string("'");
+    tk->kind = kind;
 
+    read_char(lx);
     for (;;)
     {
-        c = read_char();
-        if (is_return(c))
+        c = read_char(lx);
+        if (is_return(c) || c == EOF)
         {
-            // error
-            assert(0);
-            return NULL;
+            /* 閉じていない. 構文解析器が不正なトークンとして報告する */
+            make_invalid(tk);
+            return;
         }
-        else if (c == '\'')
+        else if (c == quote)
         {
-            append_chars(tk->str, "'");
-            return tk;
+            set_text(lx, tk, start);
+            return;
         }
         else if (c == '\\')
         {
-            append_char(tk->str, c);
-            append_char(tk->str, read_char());
-        }
-        else
-        {
-            append_char(tk->str, c);
+            read_char(lx);
         }
     }
 }
@@ -413,273 +246,478 @@ is_simple_escape(int c)
 */
 
 static bool
-is_nondigit(int c) { return isalpha(c) || c == '_'; }
+is_nondigit(int c) { return CLASS(c) & CC_NONDIGIT; }
 
 static bool
 is_digit(int c, int base)
 {
     switch (base)
     {
-    case 8:  return isdigit(c) && c != '8' && c != '9';
-    case 10: return isdigit(c);
-    case 16: return isdigit(c) || ('a' <= c && c <= 'f') || ('A' <= c && c <= 'F');
+    case 8:  return CLASS(c) & CC_OCT;
+    case 10: return CLASS(c) & CC_DIGIT;
+    case 16: return CLASS(c) & CC_HEX;
     }
     return false;
 }
 
 static bool
-is_space(int c) { return c == ' ' || c == '\t' || c == '\v'; }
-
-static bool
-is_return(int c) { return c == '\n' || c == '\r'; }
+is_return(int c) { return CLASS(c) & CC_RETURN; }
 
 static void
 set_keyword(Token *tk)
 {
-#define op(x, y)
-#define keyword(x, y) \
-    if (strcmp(string2char(tk->str), y) == 0) \
-    { \
-        free_string(tk->str); \
-        tk->str = NULL; \
-        tk->kind = x; \
-        return; \
+    int h = KEYWORD_HASH(tk->text, tk->len);
+
+    if (keyword_table[h].len == tk->len && memcmp(keyword_table[h].name, tk->text, tk->len) == 0)
+    {
+        tk->kind = keyword_table[h].kind;
     }
-#include "keyword.inc"
-#undef op
-#undef keyword
 }
 
 static void
-skip()
+skip(Lexer *lx)
 {
+    const char *q;
     int c;
     for (;;)
     {
-        c = read_char();
-        if (is_space(c) || is_return(c))
+        q = scan_blank(lx->p, lx->src_end);
+        seek(lx, q);
+        /* 空白の後の行継続を読み飛ばした. その後にも空白が続きうる */
+        if (lx->p != q) continue;
+        if (lx->p == lx->src_end && refill(lx)) continue;
+        c = peek_char(lx);
+
+        if (c == '/' && peek_char2(lx) == '*')
         {
-            continue;
-        }
-
-        if (c == '/')
-        {
-            if (estimate('*'))
+            read_char(lx);
+            read_char(lx);
+            for (;;)
             {
-                for (;;)
+                q = scan_char2(lx->p, lx->src_end, '*', '*');
+                if (q == lx->src_end)
                 {
-                    if ((c = read_char()) == '*')
-                    {
-                        if (estimate('/')) break;
-                    }
+                    lx->p = lx->src_end;
+                    if (refill(lx)) continue;
+                    return;
                 }
+                seek(lx, q + 1);
+                if (estimate(lx, '/')) break;
             }
-            else if (estimate('/'))
-            {
-                for (; !is_return(c); c = read_char());
-            }
-            else
+        }
+        else if (c == '/' && peek_char2(lx) == '/')
+        {
+            for (;;)
             {
-                unread_char(c);
-                return;
+                q = scan_char2(lx->p, lx->src_end, '\n', '\r');
+                if (q == lx->src_end)
+                {
+                    lx->p = lx->src_end;
+                    return;
+                }
+                seek(lx, q + 1);
+                /* 行継続ならコメントは次の行に続く */
+                if (!(*q == '\n' && q[-1] == '\\')) break;
             }
         }
         else
         {
-            unread_char(c);
             return;
         }
     }
 }
 
+/*
+ * 区切り子を最長一致で読む. 途中までしか一致しなかった文字
+ * (例えば ".." の 2 文字目) は読まなかったことにする. トークンの先を覗く文字数 LEX_LOOKAHEAD はこれで決まる.
+ */
+static int
+read_pnct(Lexer *lx)
+{
+    const char *q = lx->p;
+    int state = 0, kind = 0;
+
+    while (q < lx->src_end && (state = pnct_next[state][pnct_col[(unsigned char)*q]]))
+    {
+        q = advance(lx, q);
+        if (pnct_accept[state])
+        {
+            kind = pnct_accept[state];
+            lx->p = q;
+        }
+    }
+    return kind;
+}
+
 static bool
-estimate(int x)
+estimate(Lexer *lx, int x)
 {
-    int c = read_char();
-    if (x == c) return true; else unread_char(c);
-    return false;
+    if (peek_char(lx) != x) return false;
+    read_char(lx);
+    return true;
+}
+
+/* 行継続は '\\' を見た時だけこの遅いパスで読み飛ばす */
+static const char *
+skip_splice(Lexer *lx, const char *q)
+{
+    while (q + 1 < lx->src_end && q[0] == '\\' && q[1] == '\n')
+    {
+        q += 2;
+        lx->spliced = true;
+    }
+    return q;
+}
+
+/* p を q に移す. q が行継続の上にあれば読み飛ばす */
+static void
+seek(Lexer *lx, const char *q)
+{
+    lx->p = (q < lx->src_end && *q == '\\') ? skip_splice(lx, q) : q;
 }
 
+/* q の次の論理的な文字の位置 */
+static const char *
+advance(Lexer *lx, const char *q)
+{
+    q++;
+    return (q < lx->src_end && *q == '\\') ? skip_splice(lx, q) : q;
+}
+
+static int
+peek_char(Lexer *lx)
+{
+    return lx->p < lx->src_end ? (unsigned char)*lx->p : EOF;
+}
+
+static int
+peek_char2(Lexer *lx)
+{
+    const char *q;
+    if (lx->p >= lx->src_end) return EOF;
+    q = advance(lx, lx->p);
+    return q < lx->src_end ? (unsigned char)*q : EOF;
+}
+
+static int
+read_char(Lexer *lx)
+{
+    int c;
+    if (lx->p >= lx->src_end) return EOF;
+    c = (unsigned char)*lx->p;
+    lx->p = advance(lx, lx->p);
+    return c;
+}
+
+/* buf のうち, 最後の継続行でない改行までの長さ. 無ければ 0 */
+static size_t
+line_end(const char *buf, size_t len)
+{
+    while (len > 0 && !(buf[len-1] == '\n' && (len == 1 || buf[len-2] != '\\'))) len--;
+    return len;
+}
+
+static void
+free_blocks(LexBlock *b)
+{
+    LexBlock *next;
+    for (; b; b = next)
+    {
+        next = b->next;
+        free(b);
+    }
+}
+
+/*
+ * ストリームから次のブロックを読み, そこから読むようにする. 読むものが無ければ false.
+ * 読み終えたブロックは, その字句を指すトークンが LEX_TEXT_LIFE 個先で無くなってから捨てる.
+ */
 static bool
-estimate2(int x, int y)
+refill(Lexer *lx)
 {
-    int c = read_char();
-    int d = read_char();
-    if (c == x && d == y)
+    LexStream *st = lx->stream;
+    LexBlock *b, **pb;
+    size_t n = 0;
+    ssize_t r;
+
+    if (!st) return false;
+    while (!st->eof && (st->len < STREAM_BLOCK || !(n = line_end(st->buf, st->len))))
     {
-        return true;
+        if (st->len + STREAM_READ > st->size)
+        {
+            st->size *= 2;
+            st->buf = (char*)xrealloc(st->buf, st->size);
+        }
+        r = read(st->fd, st->buf + st->len, STREAM_READ);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) st->eof = true;
+        else        st->len += r;
     }
-    else
+    if (st->eof) n = st->len;
+    if (n == 0) return false;
+
+    if (st->cur)
     {
-        unread_char(d);
-        unread_char(c);
-        return false;
+        st->cur->expire = st->ntokens + LEX_TEXT_LIFE;
+        st->cur->next = st->old;
+        st->old = st->cur;
     }
+    for (pb = &st->old; *pb && (*pb)->expire > st->ntokens; pb = &(*pb)->next);
+    free_blocks(*pb);
+    *pb = NULL;
+
+    b = (LexBlock*)xmalloc(sizeof(LexBlock) + n);
+    b->next = NULL;
+    memcpy(b->text, st->buf, n);
+    memmove(st->buf, st->buf + n, st->len - n);
+    st->len -= n;
+    st->cur = b;
+    set_source(lx, b->text, n);
+    return true;
 }
 
-static int
-peek_char()
+/* 新しい Lexer. ソースは呼び出し側が設定する */
+static Lexer *
+new_lexer(const char *path)
 {
-    int c = read_char();
-    unread_char(c);
-    return c;
+    Lexer *lx = (Lexer*)xmalloc(sizeof(Lexer));
+    lx->path = path;
+    lx->src = lx->src_end = lx->p = "";
+    lx->src_size = 0;
+    lx->src_mapped = false;
+    lx->src_owned = false;
+    lx->stream = NULL;
+    lx->cache = NULL;
+    lx->parallel = NULL;
+    lx->spliced = false;
+    lx->arena = make_arena();
+    lx->free_tokens = NULL;
+    lx->syms = make_intern();
+    return lx;
 }
 
+/* src から len バイトを読むようにする */
 static void
-unread_char(int c)
+set_source(Lexer *lx, const char *src, size_t len)
 {
-    stack_push(c);
+    lx->src = src;
+    lx->src_size = len;
+    lx->src_end = src + len;
+    seek(lx, src);
 }
 
-static int
-read_char()
+/*
+ * path を読む字句解析器を作る. ファイル全体をメモリ上に置き, ポインタを進めながら読む.
+ * 別々の Lexer は別々のスレッドで同時に使える. 開けなければ NULL を返し errno が残る.
+ */
+Lexer *
+make_lexer(const char *path)
 {
-    if (stack_count() > 0)
+    Lexer *lx;
+    struct stat st;
+    const char *src;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    /* パイプなど大きさの分からないものは読んだ分だけ解析する */
+    if (!S_ISREG(st.st_mode)) return make_lexer_fd(path, fd);
+
+    lx = new_lexer(path);
+    if (st.st_size == 0)
     {
-        return stack_pop();
+        src = "";
+    }
+    else if ((src = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED)
+    {
+        lx->src_mapped = true;
+        madvise((void*)src, st.st_size, MADV_SEQUENTIAL);
     }
     else
     {
-        int c = fgetc(file);
-        if (c == '\\')
-        {
-            int c2 = fgetc(file);
-            if (c2 == '\n')
-            {
-                return fgetc(file);
-            }
-            else
-            {
-                stack_push(c2);
-                return c;
-            }
-        }
-        else
-        {
-            return c;
-        }
+        /* mmap できないファイルは全体を読み込む */
+        char *buf = (char*)xmalloc(st.st_size);
+        size_t n = 0;
+        ssize_t r;
+        while (n < (size_t)st.st_size && (r = read(fd, buf+n, st.st_size-n)) > 0) n += r;
+        src = buf;
+        st.st_size = n;
+        lx->src_owned = true;
     }
+    close(fd);
+    set_source(lx, src, st.st_size);
+    return lx;
 }
 
-void
-lex_init(const char *path)
+/* 呼び出し側の持つ buf の len バイトを複写せずに読む. buf は Lexer より後に解放する */
+Lexer *
+make_lexer_mem(const char *name, const char *buf, size_t len)
+{
+    Lexer *lx = new_lexer(name);
+    set_source(lx, buf, len);
+    return lx;
+}
+
+/*
+ * fd をパイプのように先頭から順に読む. 全体を読み込まず, 読んだブロックは
+ * トークンが指さなくなれば捨てる. fd は free_lexer で閉じる.
+ */
+Lexer *
+make_lexer_fd(const char *name, int fd)
+{
+    Lexer *lx = new_lexer(name);
+    LexStream *st = (LexStream*)xmalloc(sizeof(LexStream));
+
+    st->fd = fd;
+    st->eof = false;
+    st->size = STREAM_BLOCK + STREAM_READ;
+    st->buf = (char*)xmalloc(st->size);
+    st->len = 0;
+    st->cur = st->old = NULL;
+    st->ntokens = 0;
+    lx->stream = st;
+    return lx;
+}
+
+/*
+ * dir のキャッシュを使う. 同じ内容のソースを前に読んでいれば以後のトークンはキャッシュから再生し,
+ * そうでなければ読んだトークンを記録して EOF でキャッシュに書く. 最初のトークンを読む前に呼ぶ.
+ * ストリームから読む Lexer と lex_parallel の後では使えないので false を返す.
+ */
+bool
+lex_use_cache(Lexer *lx, const char *dir)
 {
-    file = fopen(path, "r");
-    if (!file) eperror("fopen");
+    if (lx->stream || lx->cache || lx->parallel || lx->syms->nsyms != 0) return false;
+    lx->cache = cache_open(dir, lx->src, lx->src_size, lx->syms);
+    return true;
+}
 
-    stack = (int*)malloc(sizeof(int)*128);
-    stack_size = 128;
-    stack_p = 0;
+/*
+ * ソースを src の len バイトに置き換え, offset から読み直す. 識別子の表はそのまま使い続ける.
+ * offset はトークンの境目でなければならない. make_lexer_mem で作った Lexer でだけ使える.
+ */
+void
+lex_seek(Lexer *lx, const char *src, size_t len, size_t offset)
+{
+    set_source(lx, src, len);
+    seek(lx, src + offset);
 }
 
+/* ファイルの終わり. トークン, 字句の複製と識別子の表をまとめて解放する */
 void
-free_token(Token *tk)
+free_lexer(Lexer *lx)
 {
-    if (tk->kind == TK_IDENT
-     || tk->kind == TK_STRING
-     || tk->kind == TK_CHAR)
+    if (lx->cache) cache_close(lx->cache);
+    if (lx->parallel) free_parallel(lx->parallel);
+    if (lx->src_mapped)     munmap((void*)lx->src, lx->src_size);
+    else if (lx->src_owned) free((void*)lx->src);
+    if (lx->stream)
     {
-        free(tk->str);
+        free_blocks(lx->stream->cur);
+        free_blocks(lx->stream->old);
+        free(lx->stream->buf);
+        close(lx->stream->fd);
+        free(lx->stream);
     }
-    free(tk);
+    free_arena(lx->arena);
+    free_intern(lx->syms);
+    free(lx);
 }
 
-Token *
-read_token()
+const Arena *
+lex_arena(const Lexer *lx)
+{
+    return lx->arena;
+}
+
+void
+free_token(Lexer *lx, Token *tk)
+{
+    *(Token**)tk = lx->free_tokens;
+    lx->free_tokens = tk;
+}
+
+/* 次のトークンを tk に読む */
+void
+lex_token(Lexer *lx, Token *tk)
 {
     int c;
-    skip();
-    switch (c = read_char())
+    if (lx->cache && cache_replay(lx->cache, tk)) return;
+    if (lx->parallel)
+    {
+        parallel_next(lx->parallel, tk);
+        return;
+    }
+    skip(lx);
+    lx->spliced = false;
+    c = peek_char(lx);
+    if (is_nondigit(c))                         make_ident(lx, tk);
+    else if (is_digit(c, 10))                   make_number(lx, tk);
+    else if (c == '.' && is_digit(peek_char2(lx), 10)) make_number(lx, tk);
+    else if (CLASS(c) & CC_PNCT)                make_pnct(tk, read_pnct(lx));
+    else if (c == '"')                          make_literal(lx, tk, TK_STRING, '"');
+    else if (c == '\'')                         make_literal(lx, tk, TK_CHAR, '\'');
+    else if (c == EOF)                          make_eof(tk);
+    else
     {
-        case '[': case ']': case '{': case '}': case '(': case ')':
-        case '~': case ';': case ':': case ',': case '?':
-            return make_pnct(c);
-        case '.':
-            if (is_digit(peek_char(), 10)) return make_number(c);
-            if (estimate2('.', '.'))       return make_pnct(OP_THR);
-            return make_pnct('.');
-        case '-':
-            if (estimate('>')) return make_pnct(OP_ARROW);
-            if (estimate('-')) return make_pnct(OP_DEC);
-            if (estimate('=')) return make_pnct(OP_A_SUB);
-            return make_pnct('-');
-        case '+':
-            if (estimate('+')) return make_pnct(OP_INC);
-            if (estimate('=')) return make_pnct(OP_A_ADD);
-            return make_pnct('+');
-        case '&':
-            if (estimate('&')) return make_pnct(OP_LOG_AND);
-            if (estimate('=')) return make_pnct(OP_A_AND);
-            return make_pnct('&');
-        case '*':
-            if (estimate('=')) return make_pnct(OP_A_MUL);
-            return make_pnct('*');
-        case '^': // caret
-            if (estimate('=')) return make_pnct(OP_A_XOR);
-            return make_pnct('^');
-        case '/':
-            if (estimate('=')) return make_pnct(OP_A_DIV);
-            return make_pnct('/');
-        case '%':
-            if (estimate('=')) return make_pnct(OP_A_MOD);
-            return make_pnct('%');
-        case '<':
-            if (estimate2('<', '=')) return make_pnct(OP_A_LSHF);
-            if (estimate('<'))       return make_pnct(OP_LSHF);
-            if (estimate('='))       return make_pnct(OP_LESSEQ);
-            return make_pnct('<');
-        case '>':
-            if (estimate2('>', '=')) return make_pnct(OP_A_RSHF);
-            if (estimate('>'))       return make_pnct(OP_RSHF);
-            if (estimate('='))       return make_pnct(OP_GRTREQ);
-            return make_pnct('>');
-        case '=':
-            if (estimate('=')) return make_pnct(OP_EQ);
-            return make_pnct('=');
-        case '!':
-            if (estimate('=')) return make_pnct(OP_NOTEQ);
-            return make_pnct('!');
-        case '|':
-            if (estimate('=')) return make_pnct(OP_A_OR);
-            if (estimate('|')) return make_pnct(OP_LOG_OR);
-            return make_pnct('|');
-        case '\"':
-            return make_string_literal();
-        case '\'':
-            return make_char_literal();
-        case EOF:
-            return make_eof();
-        default:
-            if (is_digit(c, 10)) return make_number(c);
-            if (is_nondigit(c))  return make_ident(c);
+        read_char(lx);
+        make_invalid(tk);
     }
-    return make_invalid();
+    if (lx->stream) lx->stream->ntokens++;
+    if (lx->cache) cache_record(lx->cache, tk);
+}
+
+Token *
+read_token(Lexer *lx)
+{
+    Token *tk = new_token(lx);
+    lex_token(lx, tk);
+    return tk;
 }
 
 #ifdef TEST_LEX
 int
 main(int argc, char *argv[])
 {
+    Lexer *lx;
     Token *tk;
     if (argc != 2) exit(EXIT_FAILURE);
 
-    lex_init(argv[1]);
+    /* - は標準入力 */
+    if (strcmp(argv[1], "-") == 0) lx = make_lexer_fd("-", 0);
+    else if (!(lx = make_lexer(argv[1]))) eperror(argv[1]);
     for (;;)
     {
-        tk = read_token();
+        tk = read_token(lx);
         switch (tk->kind)
         {
             case TK_IDENT:
-                printf("IDENT: %s\n", string2char(tk->str));
+                printf("IDENT: %.*s\n", tk->len, tk->text);
                 break;
             case TK_NUMBER:
-                printf("NUMBER: %s\n", string2char(tk->str));
+                switch (tk->id)
+                {
+                    case T_INT:    printf("NUMBER: %d\n", tk->i);      break;
+                    case T_LINT:   printf("NUMBER: %ld\n", tk->li);    break;
+                    case T_LLINT:  printf("NUMBER: %lld\n", tk->lli);  break;
+                    case T_UINT:   printf("NUMBER: %u\n", tk->ui);     break;
+                    case T_ULINT:  printf("NUMBER: %lu\n", tk->uli);   break;
+                    case T_ULLINT: printf("NUMBER: %llu\n", tk->ulli); break;
+                    case T_FLOAT:  printf("NUMBER: %.9g\n", tk->f);    break;
+                    case T_DOUBLE: printf("NUMBER: %.17g\n", tk->d);   break;
+                    case T_LDOUBLE: printf("NUMBER: %.21Lg\n", tk->ld); break;
+                }
                 break;
             case TK_STRING:
-                printf("STRING: %s\n", string2char(tk->str));
+                printf("STRING: %.*s\n", tk->len, tk->text);
                 break;
             case TK_CHAR:
-                printf("CHAR: %s\n", string2char(tk->str));
+                printf("CHAR: %.*s\n", tk->len, tk->text);
                 break;
             case TK_EOF:
                 printf("EOF\n");
@@ -691,10 +729,109 @@ main(int argc, char *argv[])
                 printf("KEYWORD: %d\n", tk->kind);
                 break;
         }
-        free_token(tk);
+        free_token(lx, tk);
     }
 LEND:
+    arena_report(stderr, "token", lex_arena(lx));
+    free_lexer(lx);
     return EXIT_SUCCESS;
 }
 #endif
 
+
+#ifdef BENCH_LEX
+/*
+ * 字句解析の速さを測る. ファイルごとに REPS 回読んで最速の回を使う.
+ * 続けてトークンのキャッシュを空の一時ディレクトリで試し, 記録して書く初回 (cold) と
+ * 再生する 2 回目以降 (warm, REPS 回の最速) を測る.
+ * 人向けの結果を stderr に, 1 ファイル 1 行の JSON を stdout に書く.
+ */
+#define REPS 5
+
+static void
+empty_dir(const char *dir)
+{
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    char path[PATH_MAX];
+
+    if (!d) return;
+    while ((e = readdir(d)))
+    {
+        if (e->d_name[0] == '.') continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        unlink(path);
+    }
+    closedir(d);
+}
+
+/* path を dir のキャッシュを使って EOF まで読み, かかった実時間を返す */
+static double
+lex_all(const char *path, const char *dir)
+{
+    Lexer *lx;
+    Token tk;
+    Clock start, end;
+
+    stats_clock(&start);
+    if (!(lx = make_lexer(path))) eperror(path);
+    if (dir) lex_use_cache(lx, dir);
+    do lex_token(lx, &tk); while (tk.kind != TK_EOF);
+    free_lexer(lx);
+    stats_clock(&end);
+    return end.wall - start.wall;
+}
+
+int
+main(int argc, char *argv[])
+{
+    char dir[] = "/tmp/smash-cache-XXXXXX";
+    int i, rep;
+
+    if (argc < 2) exit(EXIT_FAILURE);
+    if (!mkdtemp(dir)) eperror("mkdtemp");
+    for (i = 1; i < argc; i++)
+    {
+        Lexer *lx;
+        Token tk;
+        Clock start, end;
+        long tokens = 0;
+        size_t bytes = 0;
+        double best = 0, cold, warm = 0, t;
+
+        for (rep = 0; rep < REPS; rep++)
+        {
+            stats_clock(&start);
+            if (!(lx = make_lexer(argv[i]))) eperror(argv[i]);
+            for (tokens = 1, lex_token(lx, &tk); tk.kind != TK_EOF; tokens++) lex_token(lx, &tk);
+            bytes = lx->src_size;
+            free_lexer(lx);
+            stats_clock(&end);
+            if (rep == 0 || end.wall - start.wall < best) best = end.wall - start.wall;
+        }
+
+        fprintf(stderr, "lex    %-24s %8.1f MB/s %12.0f tokens/s %8ld KB peak\n",
+                argv[i], bytes / best / 1e6, tokens / best, peak_rss());
+        printf("{\"bench\": \"lex\", \"file\": \"%s\", \"bytes\": %zu, \"tokens\": %ld, "
+               "\"seconds\": %.9f, \"mb_per_s\": %.3f, \"tokens_per_s\": %.0f, \"peak_rss_kb\": %ld}\n",
+               argv[i], bytes, tokens, best, bytes / best / 1e6, tokens / best, peak_rss());
+
+        cold = lex_all(argv[i], dir);
+        for (rep = 0; rep < REPS; rep++)
+        {
+            t = lex_all(argv[i], dir);
+            if (rep == 0 || t < warm) warm = t;
+        }
+        fprintf(stderr, "cache  %-24s %8.3f ms lex %8.3f ms cold %8.3f ms warm\n",
+                argv[i], best * 1e3, cold * 1e3, warm * 1e3);
+        printf("{\"bench\": \"lex_cache\", \"file\": \"%s\", \"bytes\": %zu, "
+               "\"lex_seconds\": %.9f, \"cold_seconds\": %.9f, \"warm_seconds\": %.9f}\n",
+               argv[i], bytes, best, cold, warm);
+
+        /* 次のファイルの cold も空のディレクトリで測る */
+        empty_dir(dir);
+    }
+    rmdir(dir);
+    return EXIT_SUCCESS;
+}
+#endif
@@ -1,19 +1,343 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "smash.h"
 
+/*
+ * ドライバ. 多数の入力ファイルを 1 つのプロセスで並列に処理する.
+ * 大きいファイルから順に始め, 結果はどのスレッドで処理しても入力の順に書く.
+ * 引数 @file は file に空白区切りで並んだ引数に置き換える. 引数 - は標準入力を読む.
+ * --stats を付けると段階ごとの時間と数を終了時に stderr に書く. --stats=json なら JSON で.
+ * --token-cache=dir を付けると字句解析の結果を dir にキャッシュし, 同じ内容のファイルでは再生する.
+ * --lex-threads=n を付けると各ファイルを n 本のスレッドで字句解析してから構文解析する.
+ * --lex-check はファイルを 1 本と n 本 (無ければ CPU の数) のスレッドで字句解析して比べるだけで, 構文解析しない.
+ * --huge-pages を付けると字句, AST, 名前のアリーナを huge page で確保する. 予約が無ければ透過的 huge page を頼る.
+ */
+
+/* 応答ファイルの入れ子の上限. 自分自身を読む応答ファイルで止まらないように */
+#define RESPONSE_DEPTH 16
+
+typedef struct
+{
+    char *path;
+    off_t size;
+    char *out;       // 結果
+    size_t out_len;
+    char *diag;      // 診断
+    size_t diag_len;
+    bool failed;
+    Stats *stats;    // --stats の無いときは NULL
+} Job;
+
+enum
+{
+    STATS_NONE,
+    STATS_TABLE,
+    STATS_JSON,
+};
+
+/* parse_each に渡す, ファイル 1 つ分の途中経過 */
+typedef struct
+{
+    Ast *tree;       // トップレベル 1 つずつ変換して使い回す
+    long nodes;
+    Stats *stats;
+} Unit;
+
+static Job *jobs;
+static int stats_mode = STATS_NONE;
+static const char *cache_dir;    // --token-cache. 無ければ NULL
+static int lex_threads;          // --lex-threads. 0 なら 1 つのスレッドで読む
+static bool lex_check;           // --lex-check
+
+static void print_uses(char *argv[]);
+static void add_arg(Vector *files, const char *arg, int depth);
+static void read_response(Vector *files, const char *path, int depth);
+static int  larger_first(const void *a, const void *b);
+static void toplevel(Node *node, void *arg);
+static void check_lex(Job *job, FILE *out, FILE *diag);
+static void compile(int i, void *arg);
+static void print_stats(FILE *f, int n);
+
 static void
 print_uses(char *argv[])
 {
-    printf("%s: [file]\n", argv[0]);
+    printf("%s: [-j threads] [--stats[=json]] [--token-cache=dir] [--lex-threads=n] [--lex-check] [--huge-pages] file... (@file reads arguments from file, - reads stdin)\n", argv[0]);
     exit(EXIT_SUCCESS);
 }
 
+static void
+add_arg(Vector *files, const char *arg, int depth)
+{
+    if (arg[0] == '@') read_response(files, arg + 1, depth + 1);
+    else               vec_push(files, strdup(arg));
+}
+
+/* 引数は空白で区切る. 引用符の中の空白と \ の次の文字はそのまま */
+static void
+read_response(Vector *files, const char *path, int depth)
+{
+    FILE *f;
+    StringBuf arg;
+    int c, quote;
+
+    if (depth > RESPONSE_DEPTH)
+    {
+        fprintf(stderr, "%s: response files nested too deeply\n", path);
+        exit(EXIT_FAILURE);
+    }
+    if (!(f = fopen(path, "r"))) eperror(path);
+
+    sbuf_init(&arg);
+    c = getc(f);
+    for (;;)
+    {
+        while (c != EOF && isspace(c)) c = getc(f);
+        if (c == EOF) break;
+
+        sbuf_clear(&arg);
+        quote = 0;
+        for (; c != EOF && (quote || !isspace(c)); c = getc(f))
+        {
+            if (c == quote)                           { quote = 0; continue; }
+            if (!quote && (c == '"' || c == '\''))    { quote = c; continue; }
+            if (c == '\\' && quote != '\'' && (c = getc(f)) == EOF) break;
+            sbuf_append_char(&arg, c);
+        }
+        add_arg(files, arg.str, depth);
+    }
+    sbuf_free(&arg);
+    fclose(f);
+}
+
+/* 大きいファイルが先. 同じ大きさなら入力の順 */
+static int
+larger_first(const void *a, const void *b)
+{
+    int i = *(const int*)a, j = *(const int*)b;
+    if (jobs[i].size != jobs[j].size) return jobs[i].size < jobs[j].size ? 1 : -1;
+    return i - j;
+}
+
+/* トップレベル 1 つを配列の AST にして数える. 終われば parse_each がノードを捨てる */
+static void
+toplevel(Node *node, void *arg)
+{
+    Unit *u = (Unit*)arg;
+    Clock start;
+
+    if (u->stats) stats_clock(&start);
+    ast_clear(u->tree);
+    ast_from_node(u->tree, node);
+    u->nodes += u->tree->len - 1;
+    if (u->stats) stats_add(u->stats, PHASE_AST, &start);
+}
+
+/* --lex-check. 並列の字句解析が 1 つのスレッドと違えば失敗にする */
+static void
+check_lex(Job *job, FILE *out, FILE *diag)
+{
+    int n = lex_threads ? lex_threads : sysconf(_SC_NPROCESSORS_ONLN);
+    long diff;
+
+    errno = 0;
+    if ((diff = check_parallel(job->path, n, out)) < 0)
+    {
+        fprintf(diag, "%s: %s\n", job->path, errno ? strerror(errno) : "cannot lex a stream in parallel");
+    }
+    if (diff != 0) job->failed = true;
+}
+
+/* ファイル 1 つを解析する. 結果と診断は Job に溜めておき, 後で順に書く */
+static void
+compile(int i, void *arg)
+{
+    Job *job = &jobs[i];
+    FILE *out = open_memstream(&job->out, &job->out_len);
+    FILE *diag = open_memstream(&job->diag, &job->diag_len);
+    Lexer *lx;
+    Parser *ps;
+    Unit u;
+    jmp_buf jb;
+    Clock start;
+    unsigned long calls;
+    unsigned long long bytes;
+    int items;
+
+    if (stats_mode != STATS_NONE)
+    {
+        job->stats = (Stats*)xmalloc(sizeof(Stats));
+        stats_init(job->stats);
+    }
+    alloc_counts(&calls, &bytes);
+
+    if (lex_check)
+    {
+        check_lex(job, out, diag);
+        fclose(out);
+        fclose(diag);
+        return;
+    }
+    if (strcmp(job->path, "-") == 0) lx = make_lexer_fd(job->path, dup(STDIN_FILENO));
+    else                             lx = make_lexer(job->path);
+    if (!lx)
+    {
+        fprintf(diag, "%s: %s\n", job->path, strerror(errno));
+        job->failed = true;
+    }
+    else
+    {
+        if (cache_dir) lex_use_cache(lx, cache_dir);
+        /* キャッシュを使うときはそちらを優先し, lex_parallel は何もしない. 時間は parse_each と同じく数えて後で除く */
+        if (job->stats) stats_clock(&start);
+        if (lex_threads > 1 && lex_parallel(lx, lex_threads, job->stats) && job->stats) stats_add(job->stats, PHASE_LEX, &start);
+        ps = make_parser(lx);
+        ps->err = diag;
+        ps->on_error = &jb;
+        parser_set_stats(ps, job->stats);
+        u.tree = make_ast_tree();
+        u.nodes = 0;
+        u.stats = job->stats;
+        if (setjmp(jb) == 0)
+        {
+            items = parse_each(ps, toplevel, &u);
+            if (job->stats) stats_add(job->stats, PHASE_PARSE, &start);
+            fprintf(out, "%s: %d top-level items, %ld nodes\n", job->path, items, u.nodes);
+        }
+        else
+        {
+            job->failed = true;
+        }
+        free_ast_tree(u.tree);
+        free_parser(ps);
+        free_lexer(lx);
+    }
+    fclose(out);
+    fclose(diag);
+
+    if (job->stats)
+    {
+        unsigned long calls_end;
+        unsigned long long bytes_end;
+        int p;
+
+        /* parse_each の時間は中で読んだ字句解析と AST の変換の時間を含むので除く */
+        job->stats->wall[PHASE_PARSE] -= job->stats->wall[PHASE_LEX] + job->stats->wall[PHASE_AST];
+        job->stats->cpu[PHASE_PARSE] -= job->stats->cpu[PHASE_LEX] + job->stats->cpu[PHASE_AST];
+        for (p = 0; p < PHASE_END; p++)
+        {
+            if (job->stats->wall[p] < 0) job->stats->wall[p] = 0;
+            if (job->stats->cpu[p] < 0) job->stats->cpu[p] = 0;
+        }
+        /*
+         * 1 つの仕事は 1 つのスレッドで最後まで走るので, このスレッドの差がこのファイルの分.
+         * --lex-threads でプールのスレッドが確保した分は lex_parallel が足してある
+         */
+        alloc_counts(&calls_end, &bytes_end);
+        job->stats->mallocs += calls_end - calls;
+        job->stats->malloc_bytes += bytes_end - bytes;
+    }
+}
+
+/* ファイルごとの計測を入力の順に書き, 最後に合計を書く */
+static void
+print_stats(FILE *f, int n)
+{
+    Stats sum;
+    int i;
+
+    stats_init(&sum);
+    if (stats_mode == STATS_JSON) fputs("{\"files\": [", f);
+    else                          stats_table_header(f);
+    for (i = 0; i < n; i++)
+    {
+        if (stats_mode == STATS_JSON)
+        {
+            fputs(i ? ",\n  " : "\n  ", f);
+            stats_json(f, jobs[i].path, jobs[i].stats);
+        }
+        else
+        {
+            stats_table_row(f, jobs[i].path, jobs[i].stats);
+        }
+        stats_merge(&sum, jobs[i].stats);
+    }
+    if (stats_mode == STATS_JSON)
+    {
+        fputs("\n],\n\"total\": ", f);
+        stats_json(f, "total", &sum);
+        fputs("}\n", f);
+    }
+    else
+    {
+        stats_table_row(f, "total", &sum);
+        fputc('\n', f);
+        stats_table_kinds(f, &sum);
+    }
+}
+
 int
 main(int argc, char *argv[])
 {
-    if (argc != 2) print_uses(argv);
+    Vector *files = make_vector();
+    struct stat st;
+    int *order;
+    int i, n, nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int status = EXIT_SUCCESS;
 
-    return EXIT_SUCCESS;
-}
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) nthreads = atoi(argv[++i]);
+        else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2]) nthreads = atoi(argv[i] + 2);
+        else if (strcmp(argv[i], "--stats") == 0) stats_mode = STATS_TABLE;
+        else if (strcmp(argv[i], "--stats=json") == 0) stats_mode = STATS_JSON;
+        else if (strncmp(argv[i], "--token-cache=", 14) == 0 && argv[i][14]) cache_dir = argv[i] + 14;
+        else if (strncmp(argv[i], "--lex-threads=", 14) == 0) lex_threads = atoi(argv[i] + 14);
+        else if (strcmp(argv[i], "--lex-check") == 0) lex_check = true;
+        else if (strcmp(argv[i], "--huge-pages") == 0) arena_use_huge_pages(true);
+        else if (argv[i][0] == '-' && argv[i][1]) print_uses(argv);
+        else add_arg(files, argv[i], 0);
+    }
+    if ((n = vec_cnt(files)) == 0) print_uses(argv);
+    if (nthreads < 1) nthreads = 1;
+    /* --lex-check は構文解析しないので計測するものが無い */
+    if (lex_check) stats_mode = STATS_NONE;
+
+    jobs = (Job*)xcalloc(n, sizeof(Job));
+    order = (int*)xmalloc(sizeof(int)*n);
+    for (i = 0; i < n; i++)
+    {
+        jobs[i].path = (char*)files->body[i];
+        /* 開けないファイルは compile で報告する */
+        jobs[i].size = stat(jobs[i].path, &st) == 0 ? st.st_size : 0;
+        order[i] = i;
+    }
+    qsort(order, n, sizeof(int), larger_first);
 
+    run_jobs(order, n, nthreads, compile, NULL);
+
+    for (i = 0; i < n; i++)
+    {
+        fwrite(jobs[i].diag, 1, jobs[i].diag_len, stderr);
+        fwrite(jobs[i].out, 1, jobs[i].out_len, stdout);
+        if (jobs[i].failed) status = EXIT_FAILURE;
+    }
+    if (stats_mode != STATS_NONE) print_stats(stderr, n);
+
+    for (i = 0; i < n; i++)
+    {
+        free(jobs[i].out);
+        free(jobs[i].diag);
+        free(jobs[i].path);
+        free(jobs[i].stats);
+    }
+    free(jobs);
+    free(order);
+    free_vector(files);
+    return status;
+}
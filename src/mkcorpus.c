@@ -0,0 +1,300 @@
+/*
+ * ベンチマーク用の C のソースを生成する.
+ *   mkcorpus 種類 [バイト数] > file.c
+ * 種類は ident, nested, number, comment, stat, top, deep.
+ * deep だけは 2 つ目の引数を入れ子の深さとする.
+ * 同じ引数からは常に同じ内容を生成する.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#define DEFAULT_SIZE (4 << 20)
+#define NEST_DEPTH   400
+#define DEEP_DEPTH   1000000
+
+static unsigned long long seed = 88172645463325252ULL;
+static long written;
+
+static unsigned int rnd(unsigned int n);
+static void out(const char *fmt, ...);
+static void ident(int n);
+static void gen_ident(long size);
+static void gen_nested(long size);
+static void gen_number(long size);
+static void gen_comment(long size);
+static void gen_stat(long size);
+static void gen_top(long size);
+static void gen_deep(long depth);
+
+/* xorshift. 生成結果を環境によらず同じにするため rand は使わない */
+static unsigned int
+rnd(unsigned int n)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return (unsigned int)(seed >> 32) % n;
+}
+
+static void
+out(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    written += vprintf(fmt, ap);
+    va_end(ap);
+}
+
+/* 番号 n の長い識別子 */
+static void
+ident(int n)
+{
+    static const char *const words[] =
+    {
+        "buffer", "length", "offset", "context", "handler", "result",
+        "element", "counter", "pointer", "request", "response", "temporary",
+    };
+    out("%s_%s_%s_%d", words[n % 12], words[n / 12 % 12], words[n / 144 % 12], n);
+}
+
+/* 長い識別子ばかりの宣言と式 */
+static void
+gen_ident(long size)
+{
+    int n = 0, i, k;
+
+    out("{\n");
+    while (written < size)
+    {
+        out("    int ");
+        ident(n++);
+        out(";\n    ");
+        ident(rnd(n));
+        out(" = ");
+        k = 2 + rnd(6);
+        for (i = 0; i < k; i++)
+        {
+            if (i) out(" %c ", "+-*/"[rnd(4)]);
+            ident(rnd(n));
+        }
+        out(";\n");
+    }
+    out("}\n");
+}
+
+/* 深く入れ子になった括弧とブロック */
+static void
+gen_nested(long size)
+{
+    int i, depth;
+
+    out("int x;\n");
+    while (written < size)
+    {
+        depth = NEST_DEPTH / 2 + rnd(NEST_DEPTH / 2);
+        out("x = ");
+        for (i = 0; i < depth; i++) out("(");
+        out("x");
+        for (i = 0; i < depth; i++) out(" %c %d)", "+-*|&^"[rnd(6)], rnd(100));
+        out(";\n");
+
+        depth = rnd(NEST_DEPTH / 4);
+        for (i = 0; i < depth; i++) out("{ ");
+        out("x = x + 1;");
+        for (i = 0; i < depth; i++) out(" }");
+        out("\n");
+    }
+}
+
+/* 数値リテラルばかりの初期化子 */
+static void
+gen_number(long size)
+{
+    int n = 0, i, k;
+
+    while (written < size)
+    {
+        out("int ");
+        k = 4 + rnd(12);
+        for (i = 0; i < k; i++)
+        {
+            if (i) out(", ");
+            out("n%d = ", n++);
+            switch (rnd(8))
+            {
+                case 0: out("%u", rnd(1000000000)); break;
+                case 1: out("0x%xU", rnd(0x7fffffff)); break;
+                case 2: out("0%o", rnd(077777)); break;
+                case 3: out("%uULL", rnd(4000000000u)); break;
+                case 4: out("%u.%u", rnd(100000), rnd(1000000)); break;
+                case 5: out("%u.%ue%d", rnd(10), rnd(100000000), (int)rnd(600) - 300); break;
+                case 6: out("0x%x.%xp%d", rnd(0xffff), rnd(0xffff), (int)rnd(100) - 50); break;
+                case 7: out("%u.%uf", rnd(1000), rnd(1000)); break;
+            }
+        }
+        out(";\n");
+    }
+}
+
+/* コメントの多いファイル */
+static void
+gen_comment(long size)
+{
+    int n = 0, i, k;
+
+    out("int x;\n");
+    while (written < size)
+    {
+        k = 1 + rnd(6);
+        out("/*\n");
+        for (i = 0; i < k; i++) out(" * comment line %d: the quick brown fox jumps over the lazy dog\n", n++);
+        out(" */\n");
+        out("x = x + %u; // trailing comment %d\n", rnd(100), n++);
+        if (rnd(4) == 0) out("// line comment that continues \\\n   onto the next line\n");
+        out("x = /* inline */ x * 2;\n");
+    }
+}
+
+/* 多くの文を持つ長いブロック */
+static void
+gen_stat(long size)
+{
+    int n = 0;
+
+    out("{\n    int i, j, sum;\n    sum = 0;\n");
+    while (written < size)
+    {
+        switch (rnd(6))
+        {
+            case 0:
+                out("    for (i = 0; i < %u; i++) sum += i * %u;\n", rnd(100), rnd(10));
+                break;
+            case 1:
+                out("    if (sum > %u) sum = sum - %u; else sum = sum + 1;\n", rnd(1000), rnd(100));
+                break;
+            case 2:
+                out("    while (sum) { sum = sum >> 1; if (sum & 1) break; }\n");
+                break;
+            case 3:
+                out("    do { j = j + 1; } while (j < %u);\n", rnd(50));
+                break;
+            case 4:
+                out("L%d:\n    sum = sum ? sum : %u;\n", n++, rnd(10));
+                break;
+            case 5:
+                out("    { int t%d = sum * 3; sum = t%d + f(i, j, \"str\", 'c'); }\n", n, n);
+                n++;
+                break;
+        }
+    }
+    out("    return sum;\n}\n");
+}
+
+/* 短いトップレベルの宣言と文がたくさん並んだファイル. エディタで開くようなもの */
+static void
+gen_top(long size)
+{
+    int nv = 1, nt = 1;
+
+    out("typedef int T0;\nint v0;\n");
+    while (written < size)
+    {
+        switch (rnd(8))
+        {
+            case 0:
+                out("typedef int T%d;\n", nt++);
+                break;
+            case 1:
+                out("int v%d = %u;\n", nv++, rnd(1000));
+                break;
+            case 2:
+                out("T%u v%d;\n", rnd(nt), nv++);
+                break;
+            case 3:
+            case 4:
+                out("v%u = v%u + %u * (v%u - %u);\n", rnd(nv), rnd(nv), rnd(100), rnd(nv), rnd(10));
+                break;
+            case 5:
+                out("{\n    T%u t;\n    t = v%u;\n    v%u = t * 2;\n}\n", rnd(nt), rnd(nv), rnd(nv));
+                break;
+            case 6:
+                out("if (v%u < %u)\n    v%u = %u;\nelse\n    v%u = v%u;\n", rnd(nv), rnd(100), rnd(nv), rnd(10), rnd(nv), rnd(nv));
+                break;
+            case 7:
+                out("while (v%u) {\n    v%u = v%u - 1;\n}\n", rnd(nv), rnd(nv), rnd(nv));
+                break;
+        }
+    }
+}
+
+/* 式と文をそれぞれ depth 段に入れ子にする */
+static void
+gen_deep(long depth)
+{
+    long i;
+
+    out("int x, y;\n");
+
+    out("x = ");
+    for (i = 0; i < depth; i++) out("(");
+    out("x");
+    for (i = 0; i < depth; i++) out(")");
+    out(";\n");
+
+    for (i = 0; i < depth; i++) out("x = ");
+    out("y;\n");
+
+    out("x = ");
+    for (i = 0; i < depth; i++) out("- ");
+    out("y;\n");
+
+    out("x = ");
+    for (i = 0; i < depth; i++) out("x ? y : ");
+    out("y;\n");
+
+    out("x = ");
+    for (i = 0; i < depth; i++) out("f(x[");
+    out("y");
+    for (i = 0; i < depth; i++) out("])");
+    out(";\n");
+
+    for (i = 0; i < depth; i++) out("{");
+    out("x;");
+    for (i = 0; i < depth; i++) out("}");
+    out("\n");
+
+    for (i = 0; i < depth; i++) out("if (x) while (y) ");
+    out("break;\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    long size = argc > 2 ? atol(argv[2]) : 0;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "%s: ident|nested|number|comment|stat|top|deep [bytes or depth]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (strcmp(argv[1], "deep") == 0)
+    {
+        gen_deep(size ? size : DEEP_DEPTH);
+        return EXIT_SUCCESS;
+    }
+    if (!size) size = DEFAULT_SIZE;
+    if      (strcmp(argv[1], "ident") == 0)   gen_ident(size);
+    else if (strcmp(argv[1], "nested") == 0)  gen_nested(size);
+    else if (strcmp(argv[1], "number") == 0)  gen_number(size);
+    else if (strcmp(argv[1], "comment") == 0) gen_comment(size);
+    else if (strcmp(argv[1], "stat") == 0)    gen_stat(size);
+    else if (strcmp(argv[1], "top") == 0)     gen_top(size);
+    else
+    {
+        fprintf(stderr, "%s: unknown kind %s\n", argv[0], argv[1]);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
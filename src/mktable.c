@@ -0,0 +1,389 @@
+/*
+ * keyword.inc から字句解析用の表を生成する.
+ * (文字の分類表, 区切り子の DFA, キーワードの完全ハッシュ表)
+ * ビルド時に実行され, 生成結果は lex_table.inc として lex.c から読み込まれる.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    const char *enum_name;
+    const char *name;
+    int len;
+} Keyword;
+
+typedef struct
+{
+    const char *enum_name;
+    const char *str;
+} Pnct;
+
+static Keyword keywords[] =
+{
+#define op(x, y)
+#define keyword(x, y) {#x, y, sizeof(y)-1},
+#include "keyword.inc"
+#undef op
+#undef keyword
+};
+
+static Pnct ops[] =
+{
+#define op(x, y) {#x, y},
+#define keyword(x, y)
+#include "keyword.inc"
+#undef op
+#undef keyword
+};
+
+#define NKEYWORDS ((int)(sizeof(keywords)/sizeof(keywords[0])))
+#define NOPS ((int)(sizeof(ops)/sizeof(ops[0])))
+
+/* 1 文字の区切り子. 種類は文字コードそのもの */
+static const char single_pnct[] = "[](){}.&*+-~!/%<>^|?:;=,";
+
+#define MAX_STATES 256
+static char states[MAX_STATES][8];
+static int  nstates;
+
+/* lex.c の KEYWORD_HASH と同じ式でなければならない */
+static unsigned int
+hash(const char *s, int len, unsigned int k0, unsigned int k1, unsigned int k2, unsigned int mask)
+{
+    return (len*k0 + (unsigned char)s[0]*k1 + (unsigned char)s[len-1]*k2) & mask;
+}
+
+static void
+gen_keyword()
+{
+    unsigned int size, k0, k1, k2;
+    int i, slot[1024];
+
+    /* 衝突の無いパラメータが見つかるまで表の大きさと係数を増やす */
+    for (size = 64; size <= 1024; size *= 2)
+    {
+        for (k0 = 1; k0 < 64; k0++)
+        for (k1 = 1; k1 < 64; k1++)
+        for (k2 = 1; k2 < 64; k2++)
+        {
+            for (i = 0; i < (int)size; i++) slot[i] = -1;
+            for (i = 0; i < NKEYWORDS; i++)
+            {
+                unsigned int h = hash(keywords[i].name, keywords[i].len, k0, k1, k2, size-1);
+                if (slot[h] >= 0) break;
+                slot[h] = i;
+            }
+            if (i == NKEYWORDS) goto FOUND;
+        }
+    }
+    fprintf(stderr, "mktable: perfect hash not found\n");
+    exit(EXIT_FAILURE);
+
+FOUND:
+    printf("#define KEYWORD_HASH_SIZE %u\n", size);
+    printf("#define KEYWORD_HASH(s, len) \\\n"
+           "    (((len)*%uu + (unsigned char)(s)[0]*%uu + (unsigned char)(s)[(len)-1]*%uu) & %uu)\n\n",
+           k0, k1, k2, size-1);
+    printf("static const struct\n{\n    const char *name;\n    int len;\n    int kind;\n}\n");
+    printf("keyword_table[KEYWORD_HASH_SIZE] =\n{\n");
+    for (i = 0; i < (int)size; i++)
+    {
+        if (slot[i] < 0)
+        {
+            printf("    {NULL, 0, 0},\n");
+        }
+        else
+        {
+            Keyword *k = &keywords[slot[i]];
+            printf("    {\"%s\", %d, %s},\n", k->name, k->len, k->enum_name);
+        }
+    }
+    printf("};\n");
+}
+
+static void
+gen_class()
+{
+    int c;
+
+    printf("#define CC_SPACE    0x01\n");
+    printf("#define CC_RETURN   0x02\n");
+    printf("#define CC_DIGIT    0x04\n");
+    printf("#define CC_OCT      0x08\n");
+    printf("#define CC_HEX      0x10\n");
+    printf("#define CC_NONDIGIT 0x20\n");
+    printf("#define CC_PNCT     0x40\n\n");
+    printf("static const unsigned char char_class[256] =\n{");
+    for (c = 0; c < 256; c++)
+    {
+        int cc = 0;
+        if (c == ' ' || c == '\t' || c == '\v') cc |= 0x01;
+        if (c == '\n' || c == '\r')             cc |= 0x02;
+        if ('0' <= c && c <= '9')               cc |= 0x04 | 0x10;
+        if ('0' <= c && c <= '7')               cc |= 0x08;
+        if (('a' <= c && c <= 'f') || ('A' <= c && c <= 'F')) cc |= 0x10;
+        if (('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || c == '_') cc |= 0x20;
+        if (c != 0 && strchr(single_pnct, c))   cc |= 0x40;
+        printf("%s0x%02x,", (c % 16) ? " " : "\n    ", cc);
+    }
+    printf("\n};\n\n");
+}
+
+static int
+find_state(const char *s)
+{
+    int i;
+    for (i = 0; i < nstates; i++)
+    {
+        if (strcmp(states[i], s) == 0) return i;
+    }
+    return -1;
+}
+
+static void
+add_state(const char *s, int len)
+{
+    char buf[8];
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    if (find_state(buf) < 0) strcpy(states[nstates++], buf);
+}
+
+static void
+print_kind(const char *s)
+{
+    int i;
+    if (s[0] != '\0' && s[1] == '\0' && strchr(single_pnct, s[0]))
+    {
+        printf("'%c'", s[0]);
+        return;
+    }
+    for (i = 0; i < NOPS; i++)
+    {
+        if (strcmp(ops[i].str, s) == 0)
+        {
+            printf("%s", ops[i].enum_name);
+            return;
+        }
+    }
+    /* ".." のように区切り子の途中にしかならない状態 */
+    printf("0");
+}
+
+/*
+ * 区切り子を認識する DFA. 状態は区切り子の接頭辞 (状態 0 は空文字列) で,
+ * pnct_next[状態][pnct_col[文字]] が次の状態 (0 は遷移無し),
+ * pnct_accept[状態] がその状態で確定する区切り子の種類 (0 は未確定).
+ */
+static void
+gen_pnct()
+{
+    int i, j, c, len, ncols = (int)strlen(single_pnct) + 1;
+
+    nstates = 0;
+    add_state("", 0);
+    for (i = 0; single_pnct[i]; i++) add_state(&single_pnct[i], 1);
+    for (i = 0; i < NOPS; i++)
+    {
+        len = strlen(ops[i].str);
+        for (j = 2; j <= len; j++) add_state(ops[i].str, j);
+    }
+
+    /* 区切り子に現れる文字は single_pnct に全て含まれている */
+    printf("#define PNCT_NSTATES %d\n", nstates);
+    printf("#define PNCT_NCOLS %d\n\n", ncols);
+    printf("static const unsigned char pnct_col[256] =\n{");
+    for (c = 0; c < 256; c++)
+    {
+        const char *q = (c != 0) ? strchr(single_pnct, c) : NULL;
+        printf("%s%2d,", (c % 16) ? " " : "\n    ", q ? (int)(q - single_pnct) + 1 : 0);
+    }
+    printf("\n};\n\n");
+
+    printf("static const unsigned char pnct_next[PNCT_NSTATES][PNCT_NCOLS] =\n{\n");
+    for (i = 0; i < nstates; i++)
+    {
+        char buf[8];
+        printf("    /* %-3s */ {0,", states[i]);
+        for (j = 0; single_pnct[j]; j++)
+        {
+            len = strlen(states[i]);
+            memcpy(buf, states[i], len);
+            buf[len] = single_pnct[j];
+            buf[len+1] = '\0';
+            printf(" %d,", (len+1 < 8) ? (find_state(buf) < 0 ? 0 : find_state(buf)) : 0);
+        }
+        printf("},\n");
+    }
+    printf("};\n\n");
+
+    printf("static const short pnct_accept[PNCT_NSTATES] =\n{\n");
+    for (i = 0; i < nstates; i++)
+    {
+        printf("    /* %-3s */ ", states[i]);
+        print_kind(states[i]);
+        printf(",\n");
+    }
+    printf("};\n\n");
+}
+
+/* 2048 ビットまでの非負整数. limb[0] が最下位 */
+#define NLIMBS 64
+typedef struct
+{
+    unsigned int limb[NLIMBS];
+} Big;
+
+static void
+big_set(Big *a, unsigned int v)
+{
+    memset(a, 0, sizeof(*a));
+    a->limb[0] = v;
+}
+
+static void
+big_mul_small(Big *a, unsigned int m)
+{
+    unsigned long long carry = 0;
+    int i;
+    for (i = 0; i < NLIMBS; i++)
+    {
+        carry += (unsigned long long)a->limb[i] * m;
+        a->limb[i] = (unsigned int)carry;
+        carry >>= 32;
+    }
+}
+
+static int
+big_bits(const Big *a)
+{
+    int i;
+    for (i = NLIMBS-1; i >= 0; i--)
+    {
+        if (a->limb[i]) return i*32 + 32 - __builtin_clz(a->limb[i]);
+    }
+    return 0;
+}
+
+static void
+big_shl1(Big *a, int bit)
+{
+    int i;
+    for (i = NLIMBS-1; i > 0; i--) a->limb[i] = (a->limb[i] << 1) | (a->limb[i-1] >> 31);
+    a->limb[0] = (a->limb[0] << 1) | bit;
+}
+
+static void
+big_shr1(Big *a)
+{
+    int i;
+    for (i = 0; i < NLIMBS-1; i++) a->limb[i] = (a->limb[i] >> 1) | (a->limb[i+1] << 31);
+    a->limb[NLIMBS-1] >>= 1;
+}
+
+static int
+big_cmp(const Big *a, const Big *b)
+{
+    int i;
+    for (i = NLIMBS-1; i >= 0; i--)
+    {
+        if (a->limb[i] != b->limb[i]) return a->limb[i] < b->limb[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+static void
+big_sub(Big *a, const Big *b)
+{
+    long long borrow = 0;
+    int i;
+    for (i = 0; i < NLIMBS; i++)
+    {
+        long long d = (long long)a->limb[i] - b->limb[i] - borrow;
+        borrow = d < 0;
+        a->limb[i] = (unsigned int)(d + (borrow ? (1LL << 32) : 0));
+    }
+}
+
+/* q = 2^b / d の商 (ビットごとの割り算) */
+static void
+big_pow2_div(Big *q, int b, const Big *d)
+{
+    Big r;
+    int i;
+    big_set(q, 0);
+    big_set(&r, 0);
+    for (i = b; i >= 0; i--)
+    {
+        big_shl1(&r, i == b);
+        big_shl1(q, 0);
+        if (big_cmp(&r, d) >= 0)
+        {
+            big_sub(&r, d);
+            q->limb[0] |= 1;
+        }
+    }
+}
+
+static void
+print_128(const Big *a)
+{
+    printf("    0x%08x%08xull, 0x%08x%08xull,\n",
+           a->limb[3], a->limb[2], a->limb[1], a->limb[0]);
+}
+
+/*
+ * Eisel-Lemire 法で使う 5^q (-342 <= q <= 308) の 128 ビット近似.
+ * q >= 0 は上位 128 ビットを切り捨て, q < 0 は 2^b / 5^-q + 1 を 128 ビットに切り詰める.
+ */
+static void
+gen_pow5()
+{
+    Big p5, c;
+    int q, z;
+
+    printf("#define POW5_MIN (-342)\n");
+    printf("#define POW5_MAX 308\n\n");
+    printf("static const unsigned long long pow5_table[2*(POW5_MAX-POW5_MIN+1)] =\n{\n");
+    for (q = -342; q < 0; q++)
+    {
+        int i;
+        big_set(&p5, 1);
+        for (i = 0; i < -q; i++) big_mul_small(&p5, 5);
+        /* 5^-q は 2 の冪ではないので, 2^z >= 5^-q となる最小の z はビット数に等しい */
+        z = big_bits(&p5);
+        big_pow2_div(&c, (q >= -27) ? z + 127 : 2*z + 128, &p5);
+        /* c += 1 */
+        for (i = 0; i < NLIMBS && ++c.limb[i] == 0; i++);
+        while (big_bits(&c) > 128) big_shr1(&c);
+        print_128(&c);
+    }
+    for (q = 0; q <= 308; q++)
+    {
+        big_set(&p5, 1);
+        for (z = 0; z < q; z++) big_mul_small(&p5, 5);
+        while (big_bits(&p5) < 128) big_shl1(&p5, 0);
+        while (big_bits(&p5) > 128) big_shr1(&p5);
+        print_128(&p5);
+    }
+    printf("};\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    printf("/* mktable によって生成. 編集しないこと */\n\n");
+    if (argc > 1 && strcmp(argv[1], "pow5") == 0)
+    {
+        gen_pow5();
+    }
+    else
+    {
+        gen_class();
+        gen_pnct();
+        gen_keyword();
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,608 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include "smash.h"
+#include "pow5_table.inc"
+
+/*
+ * 数値リテラルを 1 回の走査で読み, 値と型を決める.
+ * 整数は 8 桁ずつ (SWAR) 変換し, 浮動小数点数は Clinger の高速パス,
+ * Eisel-Lemire 法, strtod の順に試して正しく丸めた値を求める.
+ */
+
+#define IS_DIGIT(c) ((unsigned)((c) - '0') < 10)
+
+static int
+hex_value(int c)
+{
+    if ('0' <= c && c <= '9') return c - '0';
+    if ('a' <= c && c <= 'f') return c - 'a' + 10;
+    if ('A' <= c && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool
+is_ident_char(int c)
+{
+    return IS_DIGIT(c) || c == '_' || ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z');
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define HAVE_SWAR
+
+static uint64_t
+load8(const char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static bool
+is_eight_digits(uint64_t v)
+{
+    return ((v & 0xF0F0F0F0F0F0F0F0ull)
+          | (((v + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4)) == 0x3333333333333333ull;
+}
+
+/* 8 バイトの数字列の値. 先頭の文字が最下位バイトにある */
+static uint32_t
+parse_eight_digits(uint64_t v)
+{
+    const uint64_t mask = 0x000000FF000000FFull;
+    const uint64_t mul1 = 100 + (1000000ull << 32);
+    const uint64_t mul2 = 1 + (10000ull << 32);
+    v -= 0x3030303030303030ull;
+    v = (v * 10) + (v >> 8);
+    v = (((v & mask) * mul1) + (((v >> 16) & mask) * mul2)) >> 32;
+    return (uint32_t)v;
+}
+#endif
+
+/* 整数 */
+
+/*
+ * 接尾辞を読み, 値が収まる最初の型を選ぶ (C99 6.4.4.1).
+ * 8 進, 16 進は符号無しの型も候補になる.
+ */
+static const char *
+int_suffix(const char *p, const char *end, uint64_t val, bool decimal, Token *tk)
+{
+    bool u = false;
+    int l = 0;
+    int type;
+
+    if (p < end && (*p == 'u' || *p == 'U'))
+    {
+        u = true;
+        p++;
+    }
+    if (p < end && (*p == 'l' || *p == 'L'))
+    {
+        l = (p+1 < end && p[1] == p[0]) ? 2 : 1;
+        p += l;
+    }
+    if (!u && p < end && (*p == 'u' || *p == 'U'))
+    {
+        u = true;
+        p++;
+    }
+    if (p < end && is_ident_char(*p)) return NULL;
+
+    if (l == 0 && !u && val <= INT_MAX)                        type = T_INT;
+    else if (l == 0 && (u || !decimal) && val <= UINT_MAX)     type = T_UINT;
+    else if (l <= 1 && !u && val <= LONG_MAX)                  type = T_LINT;
+    else if (l <= 1 && (u || !decimal) && val <= ULONG_MAX)    type = T_ULINT;
+    else if (!u && val <= LLONG_MAX)                           type = T_LLINT;
+    else                                                       type = T_ULLINT;
+
+    tk->id = type;
+    switch (type)
+    {
+        case T_INT:    tk->i    = (int)val;                    break;
+        case T_UINT:   tk->ui   = (unsigned int)val;           break;
+        case T_LINT:   tk->li   = (long int)val;               break;
+        case T_ULINT:  tk->uli  = (unsigned long int)val;      break;
+        case T_LLINT:  tk->lli  = (long long int)val;          break;
+        case T_ULLINT: tk->ulli = (unsigned long long int)val; break;
+    }
+    return p;
+}
+
+/* 10 進の整数. 値が 64 ビットを超えた場合は下位ビットを残す */
+static const char *
+scan_decimal_int(const char *p, const char *end, Token *tk)
+{
+    uint64_t val = 0;
+    int nd = 0;
+
+#ifdef HAVE_SWAR
+    /* 19 桁までは 8 桁ずつ足しても溢れない */
+    while (end - p >= 8 && nd <= 11 && is_eight_digits(load8(p)))
+    {
+        val = val * 100000000 + parse_eight_digits(load8(p));
+        nd += 8;
+        p += 8;
+    }
+#endif
+    for (; p < end && IS_DIGIT(*p); p++, nd++)
+    {
+        val = val * 10 + (*p - '0');
+    }
+    return int_suffix(p, end, val, true, tk);
+}
+
+/* 浮動小数点数 */
+
+typedef struct
+{
+    uint64_t mantissa;
+    int power2;
+} AdjustedMantissa;
+
+typedef struct
+{
+    int mantissa_bits;      // 仮数部の明示的なビット数
+    int minimum_exponent;   // -bias
+    int infinite_power;
+    int smallest_power10;
+    int largest_power10;
+    int min_round_to_even;
+    int max_round_to_even;
+} FloatFormat;
+
+static const FloatFormat binary64 = {52, -1023, 0x7FF, -342, 308, -4, 23};
+static const FloatFormat binary32 = {23, -127, 0xFF, -64, 38, -17, 10};
+
+static uint64_t
+mul_high(uint64_t a, uint64_t b, uint64_t *lo)
+{
+    unsigned __int128 r = (unsigned __int128)a * b;
+    *lo = (uint64_t)r;
+    return (uint64_t)(r >> 64);
+}
+
+/*
+ * w * 10^q を fmt の形式に丸めた仮数と指数 (Eisel-Lemire 法).
+ * w が正確 (19 桁以下) なら常に正しい結果を返す.
+ */
+static AdjustedMantissa
+compute_float(const FloatFormat *fmt, int64_t q, uint64_t w)
+{
+    AdjustedMantissa am;
+    uint64_t hi, lo, mask;
+    int lz, upperbit, shift, index;
+
+    if (w == 0 || q < fmt->smallest_power10)
+    {
+        am.mantissa = 0;
+        am.power2 = 0;
+        return am;
+    }
+    if (q > fmt->largest_power10)
+    {
+        am.mantissa = 0;
+        am.power2 = fmt->infinite_power;
+        return am;
+    }
+
+    lz = __builtin_clzll(w);
+    w <<= lz;
+
+    /* 仮数部 + 3 ビットの精度が得られれば十分 */
+    index = 2 * (int)(q - POW5_MIN);
+    hi = mul_high(w, pow5_table[index], &lo);
+    mask = 0xFFFFFFFFFFFFFFFFull >> (fmt->mantissa_bits + 3);
+    if ((hi & mask) == mask)
+    {
+        uint64_t lo2;
+        uint64_t hi2 = mul_high(w, pow5_table[index+1], &lo2);
+        lo += hi2;
+        if (hi2 > lo) hi++;
+    }
+
+    upperbit = (int)(hi >> 63);
+    shift = upperbit + 64 - fmt->mantissa_bits - 3;
+    am.mantissa = hi >> shift;
+    am.power2 = (int)(((152170 + 65536) * q) >> 16) + 63 + upperbit - lz - fmt->minimum_exponent;
+
+    if (am.power2 <= 0)
+    {
+        /* 非正規化数 */
+        if (-am.power2 + 1 >= 64)
+        {
+            am.mantissa = 0;
+            am.power2 = 0;
+            return am;
+        }
+        am.mantissa >>= -am.power2 + 1;
+        am.mantissa += am.mantissa & 1;
+        am.mantissa >>= 1;
+        am.power2 = (am.mantissa < (1ull << fmt->mantissa_bits)) ? 0 : 1;
+        return am;
+    }
+
+    /* ちょうど中間なら偶数側に丸める */
+    if (lo <= 1 && q >= fmt->min_round_to_even && q <= fmt->max_round_to_even
+     && (am.mantissa & 3) == 1 && (am.mantissa << shift) == hi)
+    {
+        am.mantissa &= ~1ull;
+    }
+    am.mantissa += am.mantissa & 1;
+    am.mantissa >>= 1;
+    if (am.mantissa >= (2ull << fmt->mantissa_bits))
+    {
+        am.mantissa = 1ull << fmt->mantissa_bits;
+        am.power2++;
+    }
+    am.mantissa &= ~(1ull << fmt->mantissa_bits);
+    if (am.power2 >= fmt->infinite_power)
+    {
+        am.mantissa = 0;
+        am.power2 = fmt->infinite_power;
+    }
+    return am;
+}
+
+/*
+ * m * 2^e (sticky は m より下に 0 でないビットがあること) を
+ * 最近接偶数に丸めた IEEE 754 のビット列.
+ */
+static uint64_t
+round_binary(const FloatFormat *fmt, uint64_t m, int e, bool sticky)
+{
+    int mbits = fmt->mantissa_bits;
+    int lz, shift, exp;
+    uint64_t mant, rest, half;
+
+    if (m == 0) return 0;
+    lz = __builtin_clzll(m);
+    m <<= lz;
+    e -= lz;
+
+    exp = e + 63 - fmt->minimum_exponent;
+    shift = 63 - mbits;
+    if (exp <= 0)
+    {
+        shift += 1 - exp;
+        exp = 0;
+    }
+    if (shift >= 64)
+    {
+        /* 最小の非正規化数の半分を超えるかどうかだけが残る */
+        return (shift == 64 && (m >> 63) && ((m << 1) != 0 || sticky)) ? 1 : 0;
+    }
+
+    mant = m >> shift;
+    rest = m & ((1ull << shift) - 1);
+    half = 1ull << (shift - 1);
+    if (rest > half || (rest == half && (sticky || (mant & 1)))) mant++;
+
+    if (exp == 0)
+    {
+        if (mant >> mbits) exp = 1;
+    }
+    else if (mant >> (mbits + 1))
+    {
+        mant >>= 1;
+        exp++;
+    }
+    if (exp >= fmt->infinite_power) return (uint64_t)fmt->infinite_power << mbits;
+    return ((uint64_t)exp << mbits) | (mant & ((1ull << mbits) - 1));
+}
+
+static const double exact_pow10[] =
+{
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static void
+set_double(Token *tk, uint64_t bits)
+{
+    memcpy(&tk->d, &bits, sizeof(double));
+}
+
+static void
+set_float(Token *tk, uint64_t bits)
+{
+    uint32_t b = (uint32_t)bits;
+    memcpy(&tk->f, &b, sizeof(float));
+}
+
+/* [s, e) を NUL 終端した複製で strtod 系の関数に渡す */
+static void
+slow_float(Token *tk, const char *s, const char *e)
+{
+    char buf[128];
+    char *str = (e - s < (int)sizeof(buf)) ? buf : (char*)xmalloc(e - s + 1);
+
+    memcpy(str, s, e - s);
+    str[e - s] = '\0';
+    switch (tk->id)
+    {
+        case T_FLOAT:   tk->f  = strtof(str, NULL);  break;
+        case T_DOUBLE:  tk->d  = strtod(str, NULL);  break;
+        case T_LDOUBLE: tk->ld = strtold(str, NULL); break;
+    }
+    if (str != buf) free(str);
+}
+
+static uint64_t
+am_bits(const FloatFormat *fmt, AdjustedMantissa am)
+{
+    return ((uint64_t)am.power2 << fmt->mantissa_bits) | am.mantissa;
+}
+
+/* w * 10^q. truncated は w の後ろの桁を切り捨てたこと */
+static void
+decimal_float(Token *tk, uint64_t w, int64_t q, bool truncated, const char *s, const char *e)
+{
+    const FloatFormat *fmt = (tk->id == T_FLOAT) ? &binary32 : &binary64;
+    AdjustedMantissa am, am2;
+
+    if (tk->id == T_LDOUBLE)
+    {
+        slow_float(tk, s, e);
+        return;
+    }
+
+    if (!truncated)
+    {
+        if (tk->id == T_DOUBLE && w <= (1ull << 53) && -22 <= q && q <= 22)
+        {
+            tk->d = (q < 0) ? (double)w / exact_pow10[-q] : (double)w * exact_pow10[q];
+            return;
+        }
+        if (tk->id == T_FLOAT && w <= (1ull << 24) && -10 <= q && q <= 10)
+        {
+            tk->f = (q < 0) ? (float)w / (float)exact_pow10[-q] : (float)w * (float)exact_pow10[q];
+            return;
+        }
+    }
+
+    am = compute_float(fmt, q, w);
+    if (truncated)
+    {
+        /* 切り捨てた桁を含む値は w と w+1 の間にある */
+        am2 = compute_float(fmt, q, w + 1);
+        if (am.mantissa != am2.mantissa || am.power2 != am2.power2)
+        {
+            slow_float(tk, s, e);
+            return;
+        }
+    }
+    if (tk->id == T_FLOAT) set_float(tk, am_bits(fmt, am));
+    else                   set_double(tk, am_bits(fmt, am));
+}
+
+/* 指数部. 数字が無ければ NULL */
+static const char *
+scan_exponent(const char *p, const char *end, int64_t *exp)
+{
+    bool neg = false;
+    int64_t v = 0;
+
+    if (p < end && (*p == '+' || *p == '-'))
+    {
+        neg = (*p == '-');
+        p++;
+    }
+    if (p >= end || !IS_DIGIT(*p)) return NULL;
+    for (; p < end && IS_DIGIT(*p); p++)
+    {
+        if (v < 100000) v = v * 10 + (*p - '0');
+    }
+    *exp = neg ? -v : v;
+    return p;
+}
+
+static const char *
+float_suffix(const char *p, const char *end, Token *tk)
+{
+    if (p < end && (*p == 'f' || *p == 'F'))
+    {
+        tk->id = T_FLOAT;
+        p++;
+    }
+    else if (p < end && (*p == 'l' || *p == 'L'))
+    {
+        tk->id = T_LDOUBLE;
+        p++;
+    }
+    else
+    {
+        tk->id = T_DOUBLE;
+    }
+    if (p < end && is_ident_char(*p)) return NULL;
+    return p;
+}
+
+/* 10 進の浮動小数点数. s はリテラルの先頭 */
+static const char *
+scan_decimal_float(const char *s, const char *end, Token *tk)
+{
+    const char *p = s, *mend, *r;
+    uint64_t w = 0;
+    int64_t q = 0, exp;
+    int nd = 0;
+    bool truncated = false;
+    int d;
+
+    /* 整数部. 有効数字は 19 桁まで持つ */
+    for (; p < end && IS_DIGIT(*p); p++)
+    {
+        d = *p - '0';
+        if (nd == 0 && d == 0) continue;
+        if (nd < 19)
+        {
+            w = w * 10 + d;
+            nd++;
+        }
+        else
+        {
+            q++;
+            if (d) truncated = true;
+        }
+    }
+    if (p < end && *p == '.')
+    {
+        p++;
+#ifdef HAVE_SWAR
+        while (nd > 0 && nd <= 11 && end - p >= 8 && is_eight_digits(load8(p)))
+        {
+            w = w * 100000000 + parse_eight_digits(load8(p));
+            nd += 8;
+            q -= 8;
+            p += 8;
+        }
+#endif
+        for (; p < end && IS_DIGIT(*p); p++)
+        {
+            d = *p - '0';
+            if (nd == 0 && d == 0)
+            {
+                q--;
+                continue;
+            }
+            if (nd < 19)
+            {
+                w = w * 10 + d;
+                nd++;
+                q--;
+            }
+            else if (d)
+            {
+                truncated = true;
+            }
+        }
+    }
+    if (p == s || (p == s + 1 && *s == '.')) return NULL;
+
+    mend = p;
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        if (!(p = scan_exponent(p + 1, end, &exp))) return NULL;
+        q += exp;
+        mend = p;
+    }
+    if (!(r = float_suffix(p, end, tk))) return NULL;
+    decimal_float(tk, w, q, truncated, s, mend);
+    return r;
+}
+
+/* 16 進の浮動小数点数. p は "0x" の直後 */
+static const char *
+scan_hex_float(const char *s, const char *p, const char *end, Token *tk)
+{
+    const char *mend, *r;
+    uint64_t m = 0;
+    int64_t e2 = 0, exp;
+    int nd = 0, d;
+    bool sticky = false, digits = false;
+
+    for (; p < end && (d = hex_value(*p)) >= 0; p++)
+    {
+        digits = true;
+        if (nd == 0 && d == 0) continue;
+        if (nd < 16)
+        {
+            m = (m << 4) | d;
+            nd++;
+        }
+        else
+        {
+            e2 += 4;
+            if (d) sticky = true;
+        }
+    }
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && (d = hex_value(*p)) >= 0; p++)
+        {
+            digits = true;
+            if (nd == 0 && d == 0)
+            {
+                e2 -= 4;
+                continue;
+            }
+            if (nd < 16)
+            {
+                m = (m << 4) | d;
+                nd++;
+                e2 -= 4;
+            }
+            else if (d)
+            {
+                sticky = true;
+            }
+        }
+    }
+    /* 16 進の浮動小数点数には p の指数部が必須 */
+    if (!digits || p >= end || (*p != 'p' && *p != 'P')) return NULL;
+    if (!(p = scan_exponent(p + 1, end, &exp))) return NULL;
+    mend = p;
+    if (!(r = float_suffix(p, end, tk))) return NULL;
+
+    switch (tk->id)
+    {
+        case T_FLOAT:   set_float(tk, round_binary(&binary32, m, e2 + exp, sticky));  break;
+        case T_DOUBLE:  set_double(tk, round_binary(&binary64, m, e2 + exp, sticky)); break;
+        case T_LDOUBLE: slow_float(tk, s, mend);                                      break;
+    }
+    return r;
+}
+
+static const char *
+scan_hex(const char *s, const char *end, Token *tk)
+{
+    const char *p = s + 2;
+    uint64_t val = 0;
+    int d;
+
+    for (; p < end && (d = hex_value(*p)) >= 0; p++)
+    {
+        val = (val << 4) | d;
+    }
+    if (p < end && (*p == '.' || *p == 'p' || *p == 'P')) return scan_hex_float(s, s + 2, end, tk);
+    if (p == s + 2) return NULL;
+    return int_suffix(p, end, val, false, tk);
+}
+
+/* '0' で始まるリテラル. 小数点か指数部が続けば 10 進の浮動小数点数 */
+static const char *
+scan_octal(const char *s, const char *end, Token *tk)
+{
+    const char *p = s;
+    uint64_t val = 0;
+
+    for (; p < end && IS_DIGIT(*p); p++);
+    if (p < end && (*p == '.' || *p == 'e' || *p == 'E')) return scan_decimal_float(s, end, tk);
+
+    for (p = s; p < end && '0' <= *p && *p <= '7'; p++)
+    {
+        val = (val << 3) | (*p - '0');
+    }
+    if (p < end && IS_DIGIT(*p)) return NULL;
+    return int_suffix(p, end, val, false, tk);
+}
+
+/*
+ * p から始まる数値リテラルを読み, 型と値を tk に設定する.
+ * リテラルの直後の位置を返す. 不正なリテラルなら NULL.
+ */
+const char *
+scan_number(const char *p, const char *end, Token *tk)
+{
+    const char *q;
+
+    if (*p == '0' && p+1 < end && (p[1] == 'x' || p[1] == 'X')) return scan_hex(p, end, tk);
+    if (*p == '0') return scan_octal(p, end, tk);
+    if (*p == '.') return scan_decimal_float(p, end, tk);
+
+    for (q = p; q < end && IS_DIGIT(*q); q++);
+    if (q < end && (*q == '.' || *q == 'e' || *q == 'E')) return scan_decimal_float(p, end, tk);
+    return scan_decimal_int(p, end, tk);
+}
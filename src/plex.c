@@ -0,0 +1,408 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "smash.h"
+
+/*
+ * 1 つの大きなソースの並列な字句解析.
+ * ソースを継続行でない改行の直後で区切ってチャンクにし, 別々のスレッドで字句解析して繋ぐ.
+ * 文字列・文字リテラルと行コメントは改行で終わるので, 区切りで続いているのはブロックコメントだけ.
+ * それが続いているかは前から読まないと分からないので, 各チャンクを「コードから始まる」
+ * 「コメントの中から始まる」の両方で先に軽く走査しておき, 前のチャンクから順に決める.
+ * ただし行継続を挟んで '\\' の後にある改行はリテラルの中で続きうるので, そこでは区切らない.
+ * 識別子の番号は, チャンクごとの表を前のチャンクから順に Lexer の表へ登録し直して直列の場合と揃える.
+ * チャンクの中で最初に現れた順はソース全体で最初に現れた順と同じになる.
+ */
+
+/* スレッドあたりのチャンクの数. 速さの違うチャンクを盗み合って均す */
+#define CHUNKS_PER_THREAD 4
+/* これより小さいチャンクには分けない */
+#define MIN_CHUNK (256*1024)
+
+/* 走査の状態. lex.c の skip と make_literal の読み方をなぞる */
+enum
+{
+    P_CODE,
+    P_SLASH,     // コードの '/' の次
+    P_STR,
+    P_STR_ESC,   // 文字列の '\\' の次
+    P_CHR,
+    P_CHR_ESC,
+    P_LINE,      // 行コメント
+    P_BLOCK,     // ブロックコメント
+    P_STAR,      // ブロックコメントの '*' の次
+    P_END
+};
+
+/* 走査で区別する文字. 行継続は走査の前に除く */
+enum
+{
+    C_OTHER,
+    C_SLASH,
+    C_STAR,
+    C_DQUOTE,
+    C_SQUOTE,
+    C_BSLASH,
+    C_RETURN,    // '\n' と '\r'. 文字列と行コメントはどちらでも終わる
+    C_END
+};
+
+static const unsigned char pclass[256] =
+{
+    ['/'] = C_SLASH, ['*'] = C_STAR, ['"'] = C_DQUOTE, ['\''] = C_SQUOTE,
+    ['\\'] = C_BSLASH, ['\n'] = C_RETURN, ['\r'] = C_RETURN,
+};
+
+static const unsigned char pnext[P_END][C_END] =
+{
+    //             OTHER    SLASH    STAR     DQUOTE   SQUOTE   BSLASH     RETURN
+    [P_CODE]    = {P_CODE,  P_SLASH, P_CODE,  P_STR,   P_CHR,   P_CODE,    P_CODE},
+    [P_SLASH]   = {P_CODE,  P_LINE,  P_BLOCK, P_STR,   P_CHR,   P_CODE,    P_CODE},
+    [P_STR]     = {P_STR,   P_STR,   P_STR,   P_CODE,  P_STR,   P_STR_ESC, P_CODE},
+    [P_STR_ESC] = {P_STR,   P_STR,   P_STR,   P_STR,   P_STR,   P_STR,     P_STR },
+    [P_CHR]     = {P_CHR,   P_CHR,   P_CHR,   P_CHR,   P_CODE,  P_CHR_ESC, P_CODE},
+    [P_CHR_ESC] = {P_CHR,   P_CHR,   P_CHR,   P_CHR,   P_CHR,   P_CHR,     P_CHR },
+    [P_LINE]    = {P_LINE,  P_LINE,  P_LINE,  P_LINE,  P_LINE,  P_LINE,    P_CODE},
+    [P_BLOCK]   = {P_BLOCK, P_BLOCK, P_STAR,  P_BLOCK, P_BLOCK, P_BLOCK,   P_BLOCK},
+    [P_STAR]    = {P_BLOCK, P_CODE,  P_STAR,  P_BLOCK, P_BLOCK, P_BLOCK,   P_BLOCK},
+};
+
+typedef struct
+{
+    const char *start;
+    const char *end;
+    const char *resume;      // コメントの中から始まるとき, そのコメントの直後. 閉じなければ end
+    unsigned char exit[2];   // コードから, コメントの中から始めたときの終わりの状態
+    bool in_comment;         // 本当の始めの状態
+    Lexer *lx;               // 字句の複製を持つので LexParallel を解放するまで残す
+    Token *tokens;
+    long ntokens;
+    long size;
+    int *map;                // チャンクのシンボル番号 -> 全体のシンボル番号
+    unsigned long mallocs;   // lex_job で確保した回数とバイト数
+    unsigned long long malloc_bytes;
+} Chunk;
+
+typedef struct LexParallel
+{
+    const char *path;
+    Chunk *chunks;
+    int nchunks;
+    int cur;                 // 次に返すトークンのチャンクと位置
+    long next;
+} LexParallel;
+
+static bool in_comment(int state);
+static void prescan(Chunk *ck);
+static void prescan_job(int i, void *arg);
+static void lex_job(int i, void *arg);
+static void remap_job(int i, void *arg);
+static bool breakable(const char *src, const char *q);
+static int  split(const char *src, const char *end, int n, Chunk *chunks);
+static bool same_token(const Token *a, const Token *b);
+static void print_token(FILE *f, const char *title, const Token *tk);
+
+static bool
+in_comment(int state)
+{
+    return state == P_BLOCK || state == P_STAR;
+}
+
+/*
+ * チャンクをコードから始めた場合とコメントの中から始めた場合を同時に走査する.
+ * 2 つが同じ状態になれば後は同じなので, 以後は 1 つだけ進める. 多くは最初の "*\/" の辺りで揃う.
+ */
+static void
+prescan(Chunk *ck)
+{
+    const unsigned char *p = (const unsigned char*)ck->start;
+    const unsigned char *end = (const unsigned char*)ck->end;
+    int a = P_CODE, b = P_BLOCK;
+    bool joined;
+
+    ck->resume = NULL;
+    for (; p < end && a != b; p++)
+    {
+        if (p[0] == '\\' && p + 1 < end && p[1] == '\n')
+        {
+            p++;
+            continue;
+        }
+        a = pnext[a][pclass[*p]];
+        b = pnext[b][pclass[*p]];
+        if (!ck->resume && b == P_CODE) ck->resume = (const char*)p + 1;
+    }
+    /* 揃った後の b は a と同じ. コメントがまだ閉じていなければ閉じる位置も a で分かる */
+    joined = a == b;
+    for (; p < end; p++)
+    {
+        if (p[0] == '\\' && p + 1 < end && p[1] == '\n')
+        {
+            p++;
+            continue;
+        }
+        a = pnext[a][pclass[*p]];
+        if (!ck->resume && a == P_CODE) ck->resume = (const char*)p + 1;
+    }
+    if (!ck->resume) ck->resume = ck->end;
+    ck->exit[0] = a;
+    ck->exit[1] = joined ? a : b;
+}
+
+static void
+prescan_job(int i, void *arg)
+{
+    prescan(&((LexParallel*)arg)->chunks[i]);
+}
+
+/* チャンクを 1 つの Lexer で読む. EOF は最後のチャンクの分だけ残す */
+static void
+lex_job(int i, void *arg)
+{
+    LexParallel *pl = (LexParallel*)arg;
+    Chunk *ck = &pl->chunks[i];
+    const char *start = ck->in_comment ? ck->resume : ck->start;
+    Token *tk;
+    unsigned long calls;
+    unsigned long long bytes;
+
+    alloc_counts(&calls, &bytes);
+    ck->lx = make_lexer_mem(pl->path, start, ck->end - start);
+    ck->size = (ck->end - start) / 4 + 16;
+    ck->tokens = (Token*)xmalloc(sizeof(Token)*ck->size);
+    ck->ntokens = 0;
+    for (;;)
+    {
+        if (ck->ntokens == ck->size) ck->tokens = (Token*)xrealloc(ck->tokens, sizeof(Token)*(ck->size *= 2));
+        tk = &ck->tokens[ck->ntokens];
+        lex_token(ck->lx, tk);
+        if (tk->kind == TK_EOF) break;
+        ck->ntokens++;
+    }
+    if (i == pl->nchunks - 1) ck->ntokens++;
+    alloc_counts(&ck->mallocs, &ck->malloc_bytes);
+    ck->mallocs -= calls;
+    ck->malloc_bytes -= bytes;
+}
+
+/* チャンクのシンボル番号を全体の番号に付け替える */
+static void
+remap_job(int i, void *arg)
+{
+    Chunk *ck = &((LexParallel*)arg)->chunks[i];
+    long k;
+
+    for (k = 0; k < ck->ntokens; k++)
+    {
+        if (ck->tokens[k].kind == TK_IDENT) ck->tokens[k].sym = ck->map[ck->tokens[k].sym];
+    }
+    free(ck->map);
+    ck->map = NULL;
+}
+
+/*
+ * 改行 q の直後で区切れるか. 行継続の改行と, 行継続を除いて '\\' の直後にある改行は
+ * リテラルの中ならエスケープとして読まれて続くので区切らない.
+ */
+static bool
+breakable(const char *src, const char *q)
+{
+    while (q - src >= 2 && q[-1] == '\n' && q[-2] == '\\') q -= 2;
+    return !(q > src && q[-1] == '\\');
+}
+
+/* [src, end) をおよそ n 等分する. 区切りは breakable な改行の直後. 空のソースも 1 つのチャンクにする */
+static int
+split(const char *src, const char *end, int n, Chunk *chunks)
+{
+    const char *start = src, *q;
+    int i, k = 0;
+
+    for (i = 1; i <= n && (start < end || k == 0); i++)
+    {
+        q = (i == n) ? end : src + (end - src) / n * i;
+        if (q < start) q = start;
+        while (q < end && (q = memchr(q, '\n', end - q)) && !breakable(src, q)) q++;
+        q = (q && q < end) ? q + 1 : end;
+        chunks[k].start = start;
+        chunks[k].end = q;
+        chunks[k].lx = NULL;
+        chunks[k].tokens = NULL;
+        chunks[k].map = NULL;
+        k++;
+        start = q;
+    }
+    return k;
+}
+
+/*
+ * lx のソース全体を nthreads 本のスレッドで字句解析しておき, 以後の lex_token はその結果を返す.
+ * トークンと識別子の番号は 1 つのスレッドで読んだ場合と同じ. 行継続を含む字句は別の複製を指す.
+ * 最初のトークンを読む前に呼ぶ. ストリームから読む Lexer とキャッシュを使う Lexer では使えず false を返す.
+ * st が NULL でなければ, 他のスレッドでの確保の回数とバイト数を st に足す.
+ * 呼んだスレッドでの確保は alloc_counts の差に入るので足さない.
+ */
+bool
+lex_parallel(Lexer *lx, int nthreads, Stats *st)
+{
+    LexParallel *pl;
+    int *order;
+    int i, s, n;
+
+    if (lx->stream || lx->cache || lx->parallel || lx->syms->nsyms != 0) return false;
+    if (nthreads < 1) nthreads = 1;
+
+    n = nthreads * CHUNKS_PER_THREAD;
+    if ((size_t)n > lx->src_size / MIN_CHUNK) n = lx->src_size / MIN_CHUNK;
+    if (n < 1) n = 1;
+
+    pl = (LexParallel*)xmalloc(sizeof(LexParallel));
+    pl->path = lx->path;
+    pl->chunks = (Chunk*)xmalloc(sizeof(Chunk)*n);
+    pl->nchunks = split(lx->src, lx->src_end, n, pl->chunks);
+    pl->cur = 0;
+    pl->next = 0;
+    order = (int*)xmalloc(sizeof(int)*pl->nchunks);
+    for (i = 0; i < pl->nchunks; i++) order[i] = i;
+    run_jobs(order, pl->nchunks, nthreads, prescan_job, pl);
+
+    pl->chunks[0].in_comment = false;
+    for (i = 1; i < pl->nchunks; i++)
+    {
+        Chunk *prev = &pl->chunks[i-1];
+        pl->chunks[i].in_comment = in_comment(prev->exit[prev->in_comment]);
+    }
+    run_jobs(order, pl->nchunks, nthreads, lex_job, pl);
+    /* run_jobs は 1 本のスレッドなら呼んだスレッドで仕事を回す */
+    if (st && nthreads > 1 && pl->nchunks > 1)
+    {
+        for (i = 0; i < pl->nchunks; i++)
+        {
+            st->mallocs += pl->chunks[i].mallocs;
+            st->malloc_bytes += pl->chunks[i].malloc_bytes;
+        }
+    }
+
+    for (i = 0; i < pl->nchunks; i++)
+    {
+        Chunk *ck = &pl->chunks[i];
+        Intern *t = ck->lx->syms;
+
+        ck->map = (int*)xmalloc(sizeof(int)*(t->nsyms + 1));
+        for (s = 0; s < t->nsyms; s++) ck->map[s] = intern(lx->syms, sym_name(t, s), sym_len(t, s));
+        /* 名前は lx の表に複写したので, チャンクの表は空にしておく */
+        free_intern(t);
+        ck->lx->syms = make_intern();
+    }
+    run_jobs(order, pl->nchunks, nthreads, remap_job, pl);
+    free(order);
+    lx->parallel = pl;
+    return true;
+}
+
+/* 先に読んだ次のトークン. EOF の後は EOF を返し続ける */
+void
+parallel_next(struct LexParallel *pl, Token *tk)
+{
+    Chunk *ck = &pl->chunks[pl->cur];
+
+    /* コメントだけのチャンクはトークンを持たない. 最後のチャンクは EOF を必ず持つ */
+    while (pl->next == ck->ntokens)
+    {
+        ck = &pl->chunks[++pl->cur];
+        pl->next = 0;
+    }
+    *tk = ck->tokens[pl->next];
+    if (tk->kind != TK_EOF) pl->next++;
+}
+
+void
+free_parallel(struct LexParallel *pl)
+{
+    int i;
+
+    for (i = 0; i < pl->nchunks; i++)
+    {
+        if (pl->chunks[i].lx) free_lexer(pl->chunks[i].lx);
+        free(pl->chunks[i].tokens);
+    }
+    free(pl->chunks);
+    free(pl);
+}
+
+/* 字句は中身で, 数値は種類に合った値を比べる */
+static bool
+same_token(const Token *a, const Token *b)
+{
+    if (a->kind != b->kind || a->len != b->len) return false;
+    if ((a->text == NULL) != (b->text == NULL)) return false;
+    if (a->text && memcmp(a->text, b->text, a->len) != 0) return false;
+    if (a->kind == TK_IDENT) return a->sym == b->sym;
+    if (a->kind == TK_NUMBER)
+    {
+        if (a->id != b->id) return false;
+        switch (a->id)
+        {
+            case T_INT:     return a->i == b->i;
+            case T_LINT:    return a->li == b->li;
+            case T_LLINT:   return a->lli == b->lli;
+            case T_UINT:    return a->ui == b->ui;
+            case T_ULINT:   return a->uli == b->uli;
+            case T_ULLINT:  return a->ulli == b->ulli;
+            case T_FLOAT:   return a->f == b->f;
+            case T_DOUBLE:  return a->d == b->d;
+            case T_LDOUBLE: return a->ld == b->ld;
+        }
+    }
+    return true;
+}
+
+static void
+print_token(FILE *f, const char *title, const Token *tk)
+{
+    fprintf(f, "  %-8s %s", title, kind_name(tk->kind));
+    if (tk->text) fprintf(f, " \"%.*s\"", tk->len, tk->text);
+    if (tk->kind == TK_IDENT) fprintf(f, " sym %d", tk->sym);
+    fputc('\n', f);
+}
+
+/*
+ * path を 1 つのスレッドと nthreads 本のスレッドで字句解析し, トークン列を比べる.
+ * 違いを out に書き, 違ったトークンの数を返す. 開けない, またはストリームなら -1.
+ */
+long
+check_parallel(const char *path, int nthreads, FILE *out)
+{
+    Lexer *serial, *par;
+    Token a, b;
+    long n, diff = 0;
+
+    if (!(par = make_lexer(path))) return -1;
+    if (par->stream)
+    {
+        free_lexer(par);
+        return -1;
+    }
+    serial = make_lexer_mem(path, par->src, par->src_size);
+    lex_parallel(par, nthreads, NULL);
+    for (n = 0; ; n++)
+    {
+        lex_token(serial, &a);
+        lex_token(par, &b);
+        if (!same_token(&a, &b))
+        {
+            /* 最初のいくつかだけ書く */
+            if (diff++ < 10)
+            {
+                fprintf(out, "%s: token %ld differs\n", path, n);
+                print_token(out, "serial", &a);
+                print_token(out, "parallel", &b);
+            }
+        }
+        if (a.kind == TK_EOF || b.kind == TK_EOF) break;
+    }
+    fprintf(out, "%s: %ld tokens in %d chunks, %ld differ\n", path, n + 1, par->parallel->nchunks, diff);
+    free_lexer(serial);
+    free_lexer(par);
+    return diff;
+}
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "smash.h"
+
+/*
+ * ワークスティーリングによる仕事の分配.
+ * 仕事は最初にスレッドごとの両端キューへ順に配っておく.
+ * 各スレッドは自分のキューを先頭から取り, 空になったら他のキューの末尾から盗む.
+ * 途中で仕事は増えないので, どのキューも空なら終わりでよい.
+ */
+
+typedef struct
+{
+    int *jobs;
+    int head;
+    int tail;
+    pthread_mutex_t lock;
+} Deque;
+
+typedef struct
+{
+    Deque *deques;
+    int nthreads;
+    void (*fn)(int job, void *arg);
+    void *arg;
+} Pool;
+
+typedef struct
+{
+    Pool *pool;
+    int id;
+} Worker;
+
+static int  take(Deque *dq, bool steal);
+static void *work(void *arg);
+
+/* 仕事を 1 つ取る. 自分のキューは先頭から, 盗むときは末尾から. 空なら -1 */
+static int
+take(Deque *dq, bool steal)
+{
+    int job = -1;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->head < dq->tail) job = steal ? dq->jobs[--dq->tail] : dq->jobs[dq->head++];
+    pthread_mutex_unlock(&dq->lock);
+    return job;
+}
+
+static void *
+work(void *arg)
+{
+    Worker *w = (Worker*)arg;
+    Pool *pool = w->pool;
+    int i, job;
+
+    for (;;)
+    {
+        if ((job = take(&pool->deques[w->id], false)) < 0)
+        {
+            for (i = 1; i < pool->nthreads; i++)
+            {
+                job = take(&pool->deques[(w->id + i) % pool->nthreads], true);
+                if (job >= 0) break;
+            }
+            if (job < 0) return NULL;
+        }
+        pool->fn(job, pool->arg);
+    }
+}
+
+/*
+ * order に並んだ n 個の仕事を nthreads 本のスレッドで fn(job, arg) に渡す.
+ * 各スレッドはおおむね order の順に仕事を始める. すべて終わってから戻る.
+ */
+void
+run_jobs(const int *order, int n, int nthreads, void (*fn)(int job, void *arg), void *arg)
+{
+    Pool pool;
+    Worker *workers;
+    pthread_t *th;
+    int i;
+
+    if (nthreads > n) nthreads = n;
+    if (nthreads <= 1)
+    {
+        for (i = 0; i < n; i++) fn(order[i], arg);
+        return;
+    }
+
+    pool.deques = (Deque*)xmalloc(sizeof(Deque)*nthreads);
+    pool.nthreads = nthreads;
+    pool.fn = fn;
+    pool.arg = arg;
+    for (i = 0; i < nthreads; i++)
+    {
+        pool.deques[i].jobs = (int*)xmalloc(sizeof(int)*(n / nthreads + 1));
+        pool.deques[i].head = pool.deques[i].tail = 0;
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+    }
+    /* 順に配れば, どのキューも先頭ほど order の前の方の仕事になる */
+    for (i = 0; i < n; i++)
+    {
+        Deque *dq = &pool.deques[i % nthreads];
+        dq->jobs[dq->tail++] = order[i];
+    }
+
+    workers = (Worker*)xmalloc(sizeof(Worker)*nthreads);
+    th = (pthread_t*)xmalloc(sizeof(pthread_t)*nthreads);
+    for (i = 0; i < nthreads; i++)
+    {
+        workers[i] = (Worker){&pool, i};
+        pthread_create(&th[i], NULL, work, &workers[i]);
+    }
+    for (i = 0; i < nthreads; i++) pthread_join(th[i], NULL);
+
+    for (i = 0; i < nthreads; i++)
+    {
+        pthread_mutex_destroy(&pool.deques[i].lock);
+        free(pool.deques[i].jobs);
+    }
+    free(pool.deques);
+    free(workers);
+    free(th);
+}
@@ -0,0 +1,210 @@
+/*
+ * 空白やコメントの読み飛ばしに使うバイト列の走査.
+ * x86 では SSE2 (実行時に使えれば AVX2) で 16/32 バイトずつ調べる.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "smash.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_SIMD
+#endif
+
+static bool
+is_blank(int c)
+{
+    return c == ' ' || c == '\t' || c == '\v' || c == '\n' || c == '\r';
+}
+
+const char *
+scan_blank_scalar(const char *p, const char *end)
+{
+    for (; p < end && is_blank((unsigned char)*p); p++);
+    return p;
+}
+
+const char *
+scan_char2_scalar(const char *p, const char *end, int a, int b)
+{
+    for (; p < end && *p != a && *p != b; p++);
+    return p;
+}
+
+#ifdef SCAN_SIMD
+static int has_avx2 = -1;
+
+/* 複数のスレッドが同時に初めて呼んでも同じ値を書くだけ */
+static bool
+use_avx2()
+{
+    int r = __atomic_load_n(&has_avx2, __ATOMIC_RELAXED);
+    if (r < 0)
+    {
+        __builtin_cpu_init();
+        r = __builtin_cpu_supports("avx2") ? 1 : 0;
+        __atomic_store_n(&has_avx2, r, __ATOMIC_RELAXED);
+    }
+    return r;
+}
+
+__attribute__((target("avx2")))
+static const char *
+scan_blank_avx2(const char *p, const char *end)
+{
+    const __m256i sp = _mm256_set1_epi8(' ');
+    const __m256i ht = _mm256_set1_epi8('\t');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i vt = _mm256_set1_epi8('\v');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    for (; end - p >= 32; p += 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*)p);
+        __m256i m = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(x, sp), _mm256_cmpeq_epi8(x, ht)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(x, lf),
+                    _mm256_or_si256(_mm256_cmpeq_epi8(x, vt), _mm256_cmpeq_epi8(x, cr))));
+        unsigned int bits = ~(unsigned int)_mm256_movemask_epi8(m);
+        if (bits) return p + __builtin_ctz(bits);
+    }
+    return scan_blank_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *
+scan_char2_avx2(const char *p, const char *end, int a, int b)
+{
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    for (; end - p >= 32; p += 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*)p);
+        __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(x, va), _mm256_cmpeq_epi8(x, vb));
+        unsigned int bits = (unsigned int)_mm256_movemask_epi8(m);
+        if (bits) return p + __builtin_ctz(bits);
+    }
+    return scan_char2_scalar(p, end, a, b);
+}
+
+static const char *
+scan_blank_sse2(const char *p, const char *end)
+{
+    const __m128i sp = _mm_set1_epi8(' ');
+    const __m128i ht = _mm_set1_epi8('\t');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i vt = _mm_set1_epi8('\v');
+    const __m128i cr = _mm_set1_epi8('\r');
+    for (; end - p >= 16; p += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*)p);
+        __m128i m = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(x, sp), _mm_cmpeq_epi8(x, ht)),
+                _mm_or_si128(_mm_cmpeq_epi8(x, lf),
+                    _mm_or_si128(_mm_cmpeq_epi8(x, vt), _mm_cmpeq_epi8(x, cr))));
+        unsigned int bits = ~(unsigned int)_mm_movemask_epi8(m) & 0xffff;
+        if (bits) return p + __builtin_ctz(bits);
+    }
+    return scan_blank_scalar(p, end);
+}
+
+static const char *
+scan_char2_sse2(const char *p, const char *end, int a, int b)
+{
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    for (; end - p >= 16; p += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*)p);
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(x, vb));
+        unsigned int bits = (unsigned int)_mm_movemask_epi8(m);
+        if (bits) return p + __builtin_ctz(bits);
+    }
+    return scan_char2_scalar(p, end, a, b);
+}
+#endif
+
+/* p 以降で最初の空白 (改行を含む) でない文字の位置. 無ければ end */
+const char *
+scan_blank(const char *p, const char *end)
+{
+    /* 空白が 1 文字だけの場合がほとんどなので先に調べる */
+    if (p < end && !is_blank((unsigned char)*p)) return p;
+#ifdef SCAN_SIMD
+    if (use_avx2()) return scan_blank_avx2(p, end);
+    return scan_blank_sse2(p, end);
+#else
+    return scan_blank_scalar(p, end);
+#endif
+}
+
+/* p 以降で最初に a か b が現れる位置. 無ければ end */
+const char *
+scan_char2(const char *p, const char *end, int a, int b)
+{
+#ifdef SCAN_SIMD
+    if (use_avx2()) return scan_char2_avx2(p, end, a, b);
+    return scan_char2_sse2(p, end, a, b);
+#else
+    return scan_char2_scalar(p, end, a, b);
+#endif
+}
+
+#ifdef BENCH_SCAN
+#include <time.h>
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* run 文字ごとに目的の文字が現れるバッファを全体にわたって走査する */
+static void
+bench(const char *name, int run, int blank,
+      const char *(*f)(const char *, const char *),
+      const char *(*g)(const char *, const char *, int, int))
+{
+    const size_t size = 64 << 20;
+    char *buf = (char*)malloc(size);
+    const char *p, *end = buf + size;
+    double t;
+    size_t i;
+    int rep, hits = 0;
+
+    for (i = 0; i < size; i++)
+    {
+        if (blank) buf[i] = (i % run == run-1) ? 'x' : " \t\n"[i % 3];
+        else       buf[i] = (i % run == run-1) ? '\n' : 'a' + i % 26;
+    }
+
+    t = now();
+    for (rep = 0; rep < 4; rep++)
+    {
+        for (p = buf; p < end; p++, hits++)
+        {
+            p = f ? f(p, end) : g(p, end, '\n', '\r');
+        }
+    }
+    t = now() - t;
+    printf("%-24s run=%-5d %8.1f MB/s (%d)\n", name, run, 4.0*size/t/1e6, hits);
+    free(buf);
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const int runs[] = {4, 16, 80, 1024};
+    int i;
+    for (i = 0; i < 4; i++)
+    {
+        bench("blank/scalar",  runs[i], 1, scan_blank_scalar, NULL);
+        bench("blank/simd",    runs[i], 1, scan_blank, NULL);
+        bench("newline/scalar", runs[i], 0, NULL, scan_char2_scalar);
+        bench("newline/simd",  runs[i], 0, NULL, scan_char2);
+    }
+    return EXIT_SUCCESS;
+}
+#endif
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "smash.h"
+
+/*
+ * スコープ付きの記号表.
+ * シンボル番号で引く表 head に各名前の一番内側の束縛を持つ.
+ * 束縛は宣言順に積み, 外側の同名の束縛を prev で覚えておく.
+ * スコープを抜けるときはそのスコープで積んだ分を下ろしながら head を戻す.
+ */
+
+void
+scope_init(Scope *sc)
+{
+    sc->bindings = NULL;
+    sc->head = sc->marks = NULL;
+    sc->bindings_size = sc->head_size = sc->marks_size = 0;
+    sc->nbindings = sc->depth = 0;
+}
+
+void
+scope_close(Scope *sc)
+{
+    free(sc->bindings);
+    free(sc->head);
+    free(sc->marks);
+    scope_init(sc);
+}
+
+/* ファイルスコープは 0 */
+int
+scope_depth(const Scope *sc)
+{
+    return sc->depth;
+}
+
+void
+scope_push(Scope *sc)
+{
+    if (sc->depth >= sc->marks_size)
+    {
+        sc->marks_size = sc->marks_size ? sc->marks_size * 2 : 64;
+        sc->marks = (int*)xrealloc(sc->marks, sizeof(int)*sc->marks_size);
+    }
+    sc->marks[sc->depth++] = sc->nbindings;
+}
+
+void
+scope_pop(Scope *sc)
+{
+    int mark;
+
+    if (sc->depth <= 0) return;
+    mark = sc->marks[--sc->depth];
+    while (sc->nbindings > mark)
+    {
+        Binding *b = &sc->bindings[--sc->nbindings];
+        sc->head[b->sym] = b->prev;
+    }
+}
+
+/*
+ * ファイルスコープに戻り, 束縛を n 個まで下ろす.
+ * 読みかけの関数やブロックをエラーで抜けた後にも使える.
+ */
+void
+scope_rewind(Scope *sc, int n)
+{
+    while (sc->depth > 0) scope_pop(sc);
+    while (sc->nbindings > n)
+    {
+        Binding *b = &sc->bindings[--sc->nbindings];
+        sc->head[b->sym] = b->prev;
+    }
+}
+
+/*
+ * 現在のスコープで sym を宣言する.
+ * 同じスコープに既に宣言があれば何もせず false を返す.
+ */
+bool
+scope_define(Scope *sc, int sym, int kind, Type *type, Node *node)
+{
+    Binding *b;
+
+    if (sym >= sc->head_size)
+    {
+        int size = sc->head_size ? sc->head_size : 1024;
+        while (size <= sym) size *= 2;
+        sc->head = (int*)xrealloc(sc->head, sizeof(int)*size);
+        for (; sc->head_size < size; sc->head_size++) sc->head[sc->head_size] = 0;
+    }
+    if (sc->head[sym] && sc->bindings[sc->head[sym]-1].depth == sc->depth) return false;
+
+    if (sc->nbindings >= sc->bindings_size)
+    {
+        sc->bindings_size = sc->bindings_size ? sc->bindings_size * 2 : 1024;
+        sc->bindings = (Binding*)xrealloc(sc->bindings, sizeof(Binding)*sc->bindings_size);
+    }
+    b = &sc->bindings[sc->nbindings];
+    b->sym = sym;
+    b->kind = kind;
+    b->depth = sc->depth;
+    b->prev = sc->head[sym];
+    b->type = type;
+    b->node = node;
+    sc->head[sym] = ++sc->nbindings;
+    return true;
+}
+
+/* sym の一番内側の束縛. 無ければ NULL */
+const Binding *
+scope_lookup(const Scope *sc, int sym)
+{
+    if (sym >= sc->head_size || !sc->head[sym]) return NULL;
+    return &sc->bindings[sc->head[sym]-1];
+}
+
+bool
+scope_is_typedef(const Scope *sc, int sym)
+{
+    const Binding *b = scope_lookup(sc, sym);
+    return b && b->kind == SYM_TYPEDEF;
+}
@@ -1,6 +1,10 @@
 #ifndef _SMASH_H_
 #define _SMASH_H_
 
+#include <stdio.h>
+#include <stddef.h>
+#include <setjmp.h>
+
 typedef int bool;
 #define true (1)
 #define false (0)
@@ -23,6 +27,7 @@ enum
     AST_COMPOUND,
     AST_LABEL,
     AST_FUNCCALL,
+    AST_DECL,
 
     // 単項演算子
     AST_GETADDR, // &
@@ -44,6 +49,8 @@ enum
 #include "keyword.inc"
 #undef op
 #undef keyword
+    // 種類の数
+    KIND_END
 };
 
 typedef struct
@@ -52,6 +59,36 @@ typedef struct
     int len;
 } String;
 
+/* string.c で文字列を組み立てる途中. 短い間は buf に置く */
+#define STRINGBUF_INLINE 64
+
+typedef struct
+{
+    char *str;        // 常に '\0' で終わる. 短い間は buf を指す
+    int len;          // '\0' を除く長さ
+    int cap;          // '\0' を除いて入る長さ
+    char buf[STRINGBUF_INLINE];
+} StringBuf;
+
+typedef struct
+{
+    struct ArenaChunk *chunk;
+    struct ArenaChunk *spare; // arena_release で空いたチャンク. 次に使う
+    char *cur;
+    char *end;
+    size_t used;
+    size_t reserved;
+    bool huge;
+} Arena;
+
+/* arena_mark で記録した位置. arena_release でここまで戻す */
+typedef struct
+{
+    struct ArenaChunk *chunk;
+    char *cur;
+    size_t used;
+} ArenaMark;
+
 typedef struct
 {
     void **body;
@@ -62,10 +99,17 @@ typedef struct
 typedef struct
 {
     int kind;
-    // TK_IDENT, TK_STRING or TK_CHAR
-    String *str;
-    // TK_NUMBER
-    int id;
+    // TK_IDENT, TK_NUMBER, TK_STRING or TK_CHAR
+    // text はソース上の字句を指す. 行継続を含む字句だけアリーナ上の複製を指す
+    int len;
+    const char *text;
+    union
+    {
+        // TK_IDENT
+        int sym;
+        // TK_NUMBER
+        int id;
+    };
     union
     {
         int i;
@@ -133,8 +177,10 @@ typedef struct Node
     Type *type;
     union
     {
-        // literal, goto
+        // string, char
         String *value;
+        // identifier, goto
+        int sym;
         // nunmber
         int i;
         long int li;
@@ -148,15 +194,15 @@ typedef struct Node
         // decl
         struct
         {
-            String *varname;
+            int varname;
             struct Node *init;
         };
-        // compound statement
+        // compound statement, declaration
         Vector *stats; // Vector<Node*>
         // label
         struct
         {
-            String *label;
+            int label;
             struct Node *stat;
         };
         // Binary operator
@@ -187,20 +233,249 @@ typedef struct Node
         struct
         {
             struct Node *obj;
-            String *member;
+            int member;
         };
     };
 } Node;
 
+/*
+ * vector.c の読みかけの子の列. NODEVEC_INLINE 個までは buf に置き, 溢れたら 2 倍ずつ伸ばす body に移す.
+ * 0 で埋めれば空の列. buf を使う間は body が NULL なので, 構造体ごと動かしてよい.
+ */
+#define NODEVEC_INLINE 4
+
+typedef struct
+{
+    Node **body;   // NULL なら buf
+    int len;
+    int size;      // body の大きさ
+    Node *buf[NODEVEC_INLINE];
+} NodeVec;
+
+/* scope.c の記号表の束縛 */
+enum
+{
+    SYM_VAR,
+    SYM_TYPEDEF,
+};
+
+typedef struct
+{
+    int sym;
+    int kind;     // SYM_VAR or SYM_TYPEDEF
+    int depth;    // 宣言したスコープの深さ
+    int prev;     // 外側の同名の束縛の添字 + 1
+    Type *type;
+    Node *node;   // ファイルスコープでは NULL
+} Binding;
+
+/* ast.c の配列による AST. 各配列の意味は ast.c を参照 */
+typedef unsigned int AstRef;
+
+typedef struct
+{
+    int len, size;
+    unsigned short *kind;
+    AstRef *a, *b, *c;
+    // 副表
+    long double *ldbl;
+    int nldbl, ldbl_size;
+    String **str;
+    int nstr, str_size;
+    AstRef *list;
+    int nlist, list_size;
+    Type **type;
+    int ntype, type_size;
+    // ast_from_node の作業用. 次の木にも使い回す
+    struct Pending *stack;
+    int stack_size;
+} Ast;
+
+/* intern.c の記号名の表 */
+typedef struct
+{
+    const char *name;
+    int len;
+    unsigned int hash;
+} Symbol;
+
+typedef struct
+{
+    Symbol *syms;
+    int nsyms;
+    int syms_size;
+    int *table;       // シンボル番号 + 1. 0 は空き
+    int table_size;
+    Arena *pool;      // 名前の実体
+} Intern;
+
+/* type.c の一意化した型の表. 修飾の無い基本型は全体で共有する */
+typedef struct
+{
+    Type **types;     // オープンアドレス法. NULL は空き
+    int ntypes;
+    int types_size;
+    TypeInfo **infos;
+    int ninfos;
+    int infos_size;
+} TypeTable;
+
+/* scope.c の記号表 */
+typedef struct
+{
+    Binding *bindings; // 束縛のスタック. これがそのまま取り消し用の記録になる
+    int nbindings;
+    int bindings_size;
+    int *head;         // シンボル番号 -> 束縛の添字 + 1. 0 は未定義
+    int head_size;
+    int *marks;        // 各スコープの開始時の nbindings
+    int depth;
+    int marks_size;
+} Scope;
+
+/*
+ * ストリームから読むとき, トークンの字句はその後このトークン数を読むまで有効.
+ * それより古いソースは捨てる. ファイルやバッファから読むときは Lexer を解放するまで有効.
+ */
+#define LEX_TEXT_LIFE 4096
+
+/*
+ * 字句解析器がトークンの終わりから先を覗く最大の文字数 (行の継続は数えない).
+ * ".." は "..." の途中なので, "x.." の後ろの "." まで見て初めて 2 つの "." と決まる.
+ */
+#define LEX_LOOKAHEAD 2
+
+/*
+ * 字句解析器の状態. ソースをメモリ上に置き, p を進めながら読む.
+ * ストリームから読むときは src から src_end が読み足したブロックで, 行の終わりで切れている.
+ * 1 つの Lexer を複数のスレッドから同時に使ってはならない.
+ */
+typedef struct
+{
+    const char *path;    // 診断に使う名前. 呼び出し側が持つ
+    const char *src;
+    const char *src_end;
+    const char *p;       // 常に論理的な文字 (行継続を除いた文字) を指す
+    size_t src_size;
+    bool src_mapped;
+    bool src_owned;      // src を free する
+    struct LexStream *stream; // ストリームから読むとき. それ以外は NULL
+    struct TokenCache *cache; // 字句解析の結果のキャッシュ. 使わなければ NULL
+    struct LexParallel *parallel; // lex_parallel で先に読んだトークン. 無ければ NULL
+    bool spliced;        // 現在のトークンを読む間に行継続を読み飛ばしたか
+    Arena *arena;        // トークンと複製した字句
+    Token *free_tokens;
+    Intern *syms;        // 識別子の表. Lexer が持つ
+} Lexer;
+
+/* stats.c の計測. 時間は字句解析, 構文解析, AST の変換の段階ごとに測る */
+enum
+{
+    PHASE_LEX,
+    PHASE_PARSE,
+    PHASE_AST,
+    PHASE_END
+};
+
+typedef struct
+{
+    double wall;
+    double cpu;
+} Clock;
+
+typedef struct
+{
+    double wall[PHASE_END];       // 秒
+    double cpu[PHASE_END];        // このスレッドの CPU 時間. 秒
+    unsigned int tokens[KIND_END];
+    unsigned int nodes[KIND_END];
+    unsigned long mallocs;
+    unsigned long long malloc_bytes;
+    int max_lookahead;            // tokens_peek で一度に見たトークンの数
+    int max_eframes;              // 一度に積んだ読みかけの式の数
+    int max_sframes;              // 一度に積んだ読みかけの文の数
+} Stats;
+
+/* tokens.c のトークン列 */
+typedef struct
+{
+    Lexer *lex;
+    Token **chunks;      // チャンク番号 -> チャンク. 解放済みは NULL
+    int nchunks;
+    Token *free_chunk;   // 再利用待ちのチャンク
+    long pos;            // 次に返すトークンの添字. 巨大な入力では 2^31 を超える
+    long filled;         // 読み終えたトークンの数
+    bool at_eof;
+    Stats *stats;        // NULL なら測らない
+} TokenStream;
+
+/* 構文解析器の状態. 字句解析器とは 1 対 1 に対応する */
+typedef struct
+{
+    Lexer *lex;
+    TokenStream ts;
+    Scope scope;
+    TypeTable types;
+    Arena *arena;        // AST と AST の文字列
+    int lcontinue;       // continue, break の飛び先のラベル. ループの外では -1
+    int lbreak;
+    unsigned int ntemps; // gensym で作った名前の数
+    FILE *err;           // 診断の書き先. 既定は stderr
+    jmp_buf *on_error;   // エラーで戻る先. NULL ならエラーで終了する
+    // 読みかけの式と文. 入れ子を再帰せずに読むためのスタック
+    struct ExprFrame *eframes;
+    int neframes;
+    int eframes_size;
+    struct StatFrame *sframes;
+    int nsframes;
+    int sframes_size;
+    NodeVec decls;       // 読みかけの宣言の変数
+} Parser;
+
+/* edit.c の差分解析する文書. 中身は edit.c だけが知る */
+typedef struct Document Document;
+
 // util.c
 void eperror(const char *msg);
+void *xmalloc(size_t size);
+void *xcalloc(size_t n, size_t size);
+void *xrealloc(void *p, size_t size);
+void alloc_counts(unsigned long *calls, unsigned long long *bytes);
+long peak_rss();
+
+// stats.c
+void   stats_init(Stats *st);
+void   stats_clock(Clock *c);
+void   stats_add(Stats *st, int phase, const Clock *since);
+void   stats_merge(Stats *dst, const Stats *src);
+const char *kind_name(int kind);
+void   stats_table_header(FILE *f);
+void   stats_table_row(FILE *f, const char *name, const Stats *st);
+void   stats_table_kinds(FILE *f, const Stats *st);
+void   stats_json(FILE *f, const char *name, const Stats *st);
+
+// arena.c
+void   arena_use_huge_pages(bool huge);
+Arena  *make_arena();
+void   free_arena(Arena *a);
+void   *arena_alloc(Arena *a, size_t size);
+size_t arena_used(const Arena *a);
+void   arena_report(FILE *f, const char *name, const Arena *a);
+ArenaMark arena_mark(const Arena *a);
+void   arena_release(Arena *a, ArenaMark m);
 
 // string.c
 String *make_string(const char *str);
+String *make_string_in(Arena *a, const char *str, int len);
 String *copy_string(const String *str);
 void   free_string(String *str);
-String *append_chars(String *s, const char *c);
-String *append_char(String *s, const char c);
+void   sbuf_init(StringBuf *sb);
+void   sbuf_free(StringBuf *sb);
+void   sbuf_clear(StringBuf *sb);
+void   sbuf_append_n(StringBuf *sb, const char *s, int n);
+void   sbuf_append(StringBuf *sb, const char *s);
+void   sbuf_append_char(StringBuf *sb, int c);
+String *sbuf_to_arena(const StringBuf *sb, Arena *a);
 const char *string2char(String *s);
 
 // vector.c
@@ -211,15 +486,114 @@ void   vec_push(Vector *vec, void *v);
 void   vec_concat(Vector *dst, Vector *src);
 void   *vec_peek(const Vector *vec);
 int    vec_cnt(const Vector *vec);
+Node   **nvec_body(NodeVec *v);
+void   nvec_push(NodeVec *v, Node *node);
+void   nvec_append(NodeVec *v, const NodeVec *src);
+void   nvec_free(NodeVec *v);
+Vector *nvec_freeze(NodeVec *v, Arena *a);
+
+// type.c
+void   type_init(TypeTable *tt);
+void   type_close(TypeTable *tt);
+Type   *type_prim(int kind);
+Type   *type_ptr(TypeTable *tt, Type *to);
+Type   *type_qualified(TypeTable *tt, Type *t, bool is_const, bool is_restrict, bool is_volatile);
+Type   *type_storage(TypeTable *tt, Type *t, bool is_static, bool is_register);
+Type   *type_struct(TypeTable *tt, int kind, TypeInfo *ti);
+TypeInfo *type_info(TypeTable *tt, Type *const *member, int n);
+
+// scope.c
+void   scope_init(Scope *sc);
+void   scope_close(Scope *sc);
+int    scope_depth(const Scope *sc);
+void   scope_push(Scope *sc);
+void   scope_pop(Scope *sc);
+void   scope_rewind(Scope *sc, int n);
+bool   scope_define(Scope *sc, int sym, int kind, Type *type, Node *node);
+const Binding *scope_lookup(const Scope *sc, int sym);
+bool   scope_is_typedef(const Scope *sc, int sym);
+
+// ast.c
+Ast    *make_ast_tree();
+void   free_ast_tree(Ast *t);
+void   ast_clear(Ast *t);
+size_t ast_bytes(const Ast *t);
+AstRef ast_add(Ast *t, int kind, AstRef a, AstRef b, AstRef c);
+AstRef ast_add_number(Ast *t, int type, const Node *val);
+AstRef ast_add_string(Ast *t, int kind, String *str);
+unsigned int ast_add_list(Ast *t, const AstRef *refs, int n);
+unsigned int ast_add_type(Ast *t, Type *type);
+int    ast_number(const Ast *t, AstRef r, Node *val);
+AstRef ast_from_node(Ast *t, const Node *root);
+
+// scan.c
+const char *scan_blank(const char *p, const char *end);
+const char *scan_char2(const char *p, const char *end, int a, int b);
+const char *scan_blank_scalar(const char *p, const char *end);
+const char *scan_char2_scalar(const char *p, const char *end, int a, int b);
+
+// intern.c
+Intern *make_intern();
+void   free_intern(Intern *t);
+int    intern(Intern *t, const char *str, int len);
+const char *sym_name(const Intern *t, int sym);
+int    sym_len(const Intern *t, int sym);
+
+// number.c
+const char *scan_number(const char *p, const char *end, Token *tk);
 
 // lex.c
-void  lex_init(const char *path);
-void  free_token(Token *tk);
-Token *read_token();
+Lexer *make_lexer(const char *path);
+Lexer *make_lexer_mem(const char *name, const char *buf, size_t len);
+Lexer *make_lexer_fd(const char *name, int fd);
+bool  lex_use_cache(Lexer *lx, const char *dir);
+void  lex_seek(Lexer *lx, const char *src, size_t len, size_t offset);
+void  free_lexer(Lexer *lx);
+const Arena *lex_arena(const Lexer *lx);
+void  free_token(Lexer *lx, Token *tk);
+void  lex_token(Lexer *lx, Token *tk);
+Token *read_token(Lexer *lx);
+
+// cache.c
+unsigned long long xxh64(const void *data, size_t len, unsigned long long seed);
+struct TokenCache *cache_open(const char *dir, const char *src, size_t size, Intern *syms);
+void  cache_close(struct TokenCache *c);
+bool  cache_replay(struct TokenCache *c, Token *tk);
+void  cache_record(struct TokenCache *c, const Token *tk);
+
+// plex.c
+bool  lex_parallel(Lexer *lx, int nthreads, Stats *st);
+void  parallel_next(struct LexParallel *pl, Token *tk);
+void  free_parallel(struct LexParallel *pl);
+long  check_parallel(const char *path, int nthreads, FILE *out);
+
+// tokens.c
+void  tokens_init(TokenStream *ts, Lexer *lx);
+void  tokens_close(TokenStream *ts);
+Token *tokens_peek(TokenStream *ts, int k);
+Token *tokens_next(TokenStream *ts);
+long  tokens_mark(const TokenStream *ts);
+
+// pool.c
+void   run_jobs(const int *order, int n, int nthreads, void (*fn)(int job, void *arg), void *arg);
 
 // parser.c
-void   parser_init();
-Node   *read_toplevel();
+Parser *make_parser(Lexer *lx);
+void   free_parser(Parser *ps);
+const Arena *parser_arena(const Parser *ps);
+void   parser_set_stats(Parser *ps, Stats *st);
+Node   *read_toplevel(Parser *ps);
+int    parse_each(Parser *ps, void (*fn)(Node *node, void *arg), void *arg);
+void   parser_restart(Parser *ps, int nbindings);
+
+// edit.c
+Document *make_document(const char *name, const char *text, size_t len);
+void   free_document(Document *doc);
+bool   doc_edit(Document *doc, size_t offset, size_t del, const char *ins, size_t len);
+const char *doc_text(const Document *doc, size_t *len);
+int    doc_items(const Document *doc);
+Node   *doc_item(const Document *doc, int i, const char **error);
+void   doc_counts(const Document *doc, int *relexed, int *reparsed);
 
 #endif
 
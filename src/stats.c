@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "smash.h"
+
+/*
+ * 段階ごとの時間と数の計測 (--stats).
+ * Stats はファイルごとに作り, 最後に stats_merge で合計する.
+ * 表は人が読むため, JSON は回帰をファイル単位で追うための出力.
+ */
+
+static const char *const names[KIND_END] =
+{
+    ['['] = "[", [']'] = "]", ['('] = "(", [')'] = ")", ['{'] = "{", ['}'] = "}",
+    ['.'] = ".", ['&'] = "&", ['*'] = "*", ['+'] = "+", ['-'] = "-", ['~'] = "~",
+    ['!'] = "!", ['/'] = "/", ['%'] = "%", ['<'] = "<", ['>'] = ">", ['^'] = "^",
+    ['|'] = "|", ['?'] = "?", [':'] = ":", [';'] = ";", ['='] = "=", [','] = ",",
+    ['#'] = "#",
+
+    [TK_IDENT]    = "IDENT",
+    [TK_NUMBER]   = "NUMBER",
+    [TK_STRING]   = "STRING",
+    [TK_CHAR]     = "CHAR",
+    [TK_EOF]      = "EOF",
+    [TK_INVALID]  = "INVALID",
+
+    [AST_IDENT]   = "AST_IDENT",
+    [AST_NUMBER]  = "AST_NUMBER",
+    [AST_STRING]  = "AST_STRING",
+    [AST_CHAR]    = "AST_CHAR",
+    [AST_LVAR]    = "AST_LVAR",
+    [AST_COMPOUND]= "AST_COMPOUND",
+    [AST_LABEL]   = "AST_LABEL",
+    [AST_FUNCCALL]= "AST_FUNCCALL",
+    [AST_DECL]    = "AST_DECL",
+    [AST_GETADDR] = "AST_GETADDR",
+    [AST_DEREF]   = "AST_DEREF",
+    [AST_PLUS]    = "AST_PLUS",
+    [AST_MINUS]   = "AST_MINUS",
+    [AST_TERNARY] = "AST_TERNARY",
+    [OP_PRE_INC]  = "OP_PRE_INC",
+    [OP_PRE_DEC]  = "OP_PRE_DEC",
+    [OP_POST_INC] = "OP_POST_INC",
+    [OP_POST_DEC] = "OP_POST_DEC",
+    [OP_CAST]     = "OP_CAST",
+#define op(x, y) [x] = y,
+#define keyword(x, y) [x] = y,
+#include "keyword.inc"
+#undef op
+#undef keyword
+};
+
+static const char *const phases[PHASE_END] = {"lex", "parse", "ast"};
+
+static unsigned long total(const unsigned int *count);
+static void json_string(FILE *f, const char *s);
+static void json_kinds(FILE *f, const unsigned int *count);
+static void table_kinds(FILE *f, const char *title, const unsigned int *count);
+
+static unsigned long
+total(const unsigned int *count)
+{
+    unsigned long n = 0;
+    int k;
+    for (k = 0; k < KIND_END; k++) n += count[k];
+    return n;
+}
+
+static void
+json_string(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')              fprintf(f, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)       fprintf(f, "\\u%04x", *s);
+        else                                     fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+/* 0 でない種類だけを書く */
+static void
+json_kinds(FILE *f, const unsigned int *count)
+{
+    const char *sep = "";
+    int k;
+
+    fputc('{', f);
+    for (k = 0; k < KIND_END; k++)
+    {
+        if (!count[k]) continue;
+        fputs(sep, f);
+        json_string(f, kind_name(k));
+        fprintf(f, ": %u", count[k]);
+        sep = ", ";
+    }
+    fputc('}', f);
+}
+
+/* 多い順 */
+static void
+table_kinds(FILE *f, const char *title, const unsigned int *count)
+{
+    int order[KIND_END];
+    int i, j, n = 0;
+
+    for (i = 0; i < KIND_END; i++)
+    {
+        if (!count[i]) continue;
+        for (j = n++; j > 0 && count[order[j-1]] < count[i]; j--) order[j] = order[j-1];
+        order[j] = i;
+    }
+    fprintf(f, "%s:\n", title);
+    for (i = 0; i < n; i++) fprintf(f, "  %-16s %10u\n", kind_name(order[i]), count[order[i]]);
+}
+
+void
+stats_init(Stats *st)
+{
+    memset(st, 0, sizeof(Stats));
+}
+
+void
+stats_clock(Clock *c)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    c->wall = ts.tv_sec + ts.tv_nsec * 1e-9;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    c->cpu = ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* since から今までを phase の時間に足す */
+void
+stats_add(Stats *st, int phase, const Clock *since)
+{
+    Clock now;
+
+    stats_clock(&now);
+    st->wall[phase] += now.wall - since->wall;
+    st->cpu[phase]  += now.cpu - since->cpu;
+}
+
+void
+stats_merge(Stats *dst, const Stats *src)
+{
+    int i;
+
+    for (i = 0; i < PHASE_END; i++)
+    {
+        dst->wall[i] += src->wall[i];
+        dst->cpu[i]  += src->cpu[i];
+    }
+    for (i = 0; i < KIND_END; i++)
+    {
+        dst->tokens[i] += src->tokens[i];
+        dst->nodes[i]  += src->nodes[i];
+    }
+    dst->mallocs += src->mallocs;
+    dst->malloc_bytes += src->malloc_bytes;
+    if (src->max_lookahead > dst->max_lookahead) dst->max_lookahead = src->max_lookahead;
+    if (src->max_eframes > dst->max_eframes) dst->max_eframes = src->max_eframes;
+    if (src->max_sframes > dst->max_sframes) dst->max_sframes = src->max_sframes;
+}
+
+/* トークンと AST の種類の名前. 1 文字の演算子はその文字 */
+const char *
+kind_name(int kind)
+{
+    return kind >= 0 && kind < KIND_END && names[kind] ? names[kind] : "?";
+}
+
+void
+stats_table_header(FILE *f)
+{
+    fprintf(f, "%-32s %9s %9s %9s %9s %9s %9s %9s %11s %5s\n",
+            "file", "lex ms", "parse ms", "ast ms", "cpu ms",
+            "tokens", "nodes", "mallocs", "bytes", "peek");
+}
+
+/* ファイル 1 つを 1 行で. 時間は実時間, cpu ms は全段階の合計 */
+void
+stats_table_row(FILE *f, const char *name, const Stats *st)
+{
+    double cpu = 0;
+    int i;
+
+    for (i = 0; i < PHASE_END; i++) cpu += st->cpu[i];
+    fprintf(f, "%-32s %9.3f %9.3f %9.3f %9.3f %9lu %9lu %9lu %11llu %5d\n",
+            name,
+            st->wall[PHASE_LEX] * 1e3, st->wall[PHASE_PARSE] * 1e3, st->wall[PHASE_AST] * 1e3,
+            cpu * 1e3,
+            total(st->tokens), total(st->nodes),
+            st->mallocs, st->malloc_bytes, st->max_lookahead);
+}
+
+/* 段階ごとの時間と種類ごとの数 */
+void
+stats_table_kinds(FILE *f, const Stats *st)
+{
+    int i;
+
+    fprintf(f, "%-8s %12s %12s\n", "phase", "wall ms", "cpu ms");
+    for (i = 0; i < PHASE_END; i++)
+    {
+        fprintf(f, "%-8s %12.3f %12.3f\n", phases[i], st->wall[i] * 1e3, st->cpu[i] * 1e3);
+    }
+    fprintf(f, "max lookahead %d, max expr frames %d, max stat frames %d\n",
+            st->max_lookahead, st->max_eframes, st->max_sframes);
+    table_kinds(f, "tokens", st->tokens);
+    table_kinds(f, "nodes", st->nodes);
+}
+
+/* name の計測を 1 つの JSON オブジェクトとして書く. 時間は秒 */
+void
+stats_json(FILE *f, const char *name, const Stats *st)
+{
+    int i;
+
+    fputs("{\"name\": ", f);
+    json_string(f, name);
+    for (i = 0; i < 2; i++)
+    {
+        const double *t = i ? st->cpu : st->wall;
+        int p;
+        fprintf(f, ", \"%s\": {", i ? "cpu" : "wall");
+        for (p = 0; p < PHASE_END; p++) fprintf(f, "%s\"%s\": %.9f", p ? ", " : "", phases[p], t[p]);
+        fputc('}', f);
+    }
+    fprintf(f, ", \"tokens\": %lu, \"nodes\": %lu", total(st->tokens), total(st->nodes));
+    fprintf(f, ", \"mallocs\": %lu, \"malloc_bytes\": %llu", st->mallocs, st->malloc_bytes);
+    fprintf(f, ", \"max_lookahead\": %d, \"max_eframes\": %d, \"max_sframes\": %d",
+            st->max_lookahead, st->max_eframes, st->max_sframes);
+    fputs(", \"tokens_by_kind\": ", f);
+    json_kinds(f, st->tokens);
+    fputs(", \"nodes_by_kind\": ", f);
+    json_kinds(f, st->nodes);
+    fputc('}', f);
+}
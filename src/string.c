@@ -8,14 +8,29 @@ make_string(const char *str)
 {
     String *s;
 
-    s = (String*)malloc(sizeof(String));
+    s = (String*)xmalloc(sizeof(String));
     s->len = strlen(str) + 1;
-    s->str = (char *)malloc(sizeof(char)*s->len);
+    s->str = (char *)xmalloc(sizeof(char)*s->len);
     strcpy(s->str, str);
 
     return s;
 }
 
+/* アリーナ上の文字列. free_string で解放してはならない */
+String *
+make_string_in(Arena *a, const char *str, int len)
+{
+    String *s;
+
+    s = (String*)arena_alloc(a, sizeof(String) + len + 1);
+    s->len = len + 1;
+    s->str = (char*)(s + 1);
+    memcpy(s->str, str, len);
+    s->str[len] = '\0';
+
+    return s;
+}
+
 String *
 copy_string(const String *str)
 {
@@ -29,20 +44,81 @@ free_string(String *s)
     free(s);
 }
 
-String *
-append_chars(String *s, const char *c)
+/*
+ * 文字列を組み立てる. 長さと容量を持ち, 足すたびに全体を走査しない.
+ * STRINGBUF_INLINE バイトまでは StringBuf の中に置き, 溢れたら倍々に伸ばす.
+ * 中に置いている間は sb->str が sb 自身を指すので, StringBuf を複写してはならない.
+ */
+void
+sbuf_init(StringBuf *sb)
 {
-    s->len = strlen(c) + s->len + 1;
-    s->str = (char *)realloc(s->str, sizeof(char)*s->len);
-    strcat(s->str, c);
+    sb->str = sb->buf;
+    sb->len = 0;
+    sb->cap = STRINGBUF_INLINE - 1;
+    sb->buf[0] = '\0';
+}
 
-    return s;
+void
+sbuf_free(StringBuf *sb)
+{
+    if (sb->str != sb->buf) free(sb->str);
+    sbuf_init(sb);
+}
+
+/* 中身を空にする. 伸ばした領域は次に使う */
+void
+sbuf_clear(StringBuf *sb)
+{
+    sb->len = 0;
+    sb->str[0] = '\0';
+}
+
+/* あと n バイト書けるようにする */
+static void
+sbuf_reserve(StringBuf *sb, int n)
+{
+    int cap = sb->cap;
+
+    while (cap - sb->len < n) cap = cap * 2 + 1;
+    if (sb->str == sb->buf)
+    {
+        sb->str = (char*)memcpy(xmalloc(cap + 1), sb->buf, sb->len + 1);
+    }
+    else
+    {
+        sb->str = (char*)xrealloc(sb->str, cap + 1);
+    }
+    sb->cap = cap;
+}
+
+void
+sbuf_append_n(StringBuf *sb, const char *s, int n)
+{
+    if (sb->cap - sb->len < n) sbuf_reserve(sb, n);
+    memcpy(sb->str + sb->len, s, n);
+    sb->len += n;
+    sb->str[sb->len] = '\0';
+}
+
+void
+sbuf_append(StringBuf *sb, const char *s)
+{
+    sbuf_append_n(sb, s, strlen(s));
+}
+
+void
+sbuf_append_char(StringBuf *sb, int c)
+{
+    if (sb->len == sb->cap) sbuf_reserve(sb, 1);
+    sb->str[sb->len++] = c;
+    sb->str[sb->len] = '\0';
 }
 
+/* 組み立てた文字列をアリーナに写す */
 String *
-append_char(String *s, const char c)
+sbuf_to_arena(const StringBuf *sb, Arena *a)
 {
-    return append_chars(s, (const char[]){c, '\0'});
+    return make_string_in(a, sb->str, sb->len);
 }
 
 const char *
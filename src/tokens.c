@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "smash.h"
+
+/*
+ * 構文解析器に渡すトークン列.
+ * 字句解析器が読んだトークンを CHUNK_LEN 個ずつの配列に順に並べ,
+ * 先読みと位置の記録を添字の操作だけで行う.
+ * 直前のチャンクまでを残し, それより古いチャンクは再利用する.
+ */
+
+#define CHUNK_BITS 10
+#define CHUNK_LEN  (1 << CHUNK_BITS)
+#define CHUNK_MASK (CHUNK_LEN - 1)
+
+/* 生きているトークンは直前から次までの高々 3 チャンク. その字句が捨てられていてはならない */
+#if 3 * CHUNK_LEN > LEX_TEXT_LIFE
+#error "LEX_TEXT_LIFE is shorter than the tokens kept by TokenStream"
+#endif
+
+static Token *tok(const TokenStream *ts, long i);
+static void   fill(TokenStream *ts, long n);
+static void   retire(TokenStream *ts, long c);
+
+static Token *
+tok(const TokenStream *ts, long i)
+{
+    return &ts->chunks[i >> CHUNK_BITS][i & CHUNK_MASK];
+}
+
+/*
+ * 添字 n のトークンを含むチャンクの終わりまで読む. EOF の後は EOF を複製する.
+ * まとめて読むので計測の時計もチャンクに 1 回で済む.
+ */
+static void
+fill(TokenStream *ts, long n)
+{
+    Clock start;
+
+    if (ts->stats) stats_clock(&start);
+    n |= CHUNK_MASK;
+    while (ts->filled <= n)
+    {
+        long c = ts->filled >> CHUNK_BITS;
+        if (c >= ts->nchunks)
+        {
+            int i = ts->nchunks;
+            ts->nchunks = ts->nchunks ? ts->nchunks * 2 : 64;
+            ts->chunks = (Token**)xrealloc(ts->chunks, sizeof(Token*)*ts->nchunks);
+            for (; i < ts->nchunks; i++) ts->chunks[i] = NULL;
+        }
+        if ((ts->filled & CHUNK_MASK) == 0)
+        {
+            if (ts->free_chunk)
+            {
+                ts->chunks[c] = ts->free_chunk;
+                ts->free_chunk = NULL;
+            }
+            else
+            {
+                ts->chunks[c] = (Token*)xmalloc(sizeof(Token)*CHUNK_LEN);
+            }
+        }
+
+        if (ts->at_eof) *tok(ts, ts->filled) = *tok(ts, ts->filled-1);
+        else
+        {
+            Token *tk = tok(ts, ts->filled);
+            lex_token(ts->lex, tk);
+            ts->at_eof = tk->kind == TK_EOF;
+            if (ts->stats) ts->stats->tokens[tk->kind]++;
+        }
+        ts->filled++;
+    }
+    if (ts->stats) stats_add(ts->stats, PHASE_LEX, &start);
+}
+
+/* チャンク c はもう参照されないので次のチャンクに使う */
+static void
+retire(TokenStream *ts, long c)
+{
+    if (c < 0 || !ts->chunks[c]) return;
+    if (ts->free_chunk) free(ts->free_chunk);
+    ts->free_chunk = ts->chunks[c];
+    ts->chunks[c] = NULL;
+}
+
+void
+tokens_init(TokenStream *ts, Lexer *lx)
+{
+    ts->lex = lx;
+    ts->chunks = NULL;
+    ts->nchunks = 0;
+    ts->free_chunk = NULL;
+    ts->pos = ts->filled = 0;
+    ts->at_eof = false;
+    ts->stats = NULL;
+}
+
+void
+tokens_close(TokenStream *ts)
+{
+    int i;
+    for (i = 0; i < ts->nchunks; i++) free(ts->chunks[i]);
+    free(ts->chunks);
+    free(ts->free_chunk);
+    ts->chunks = NULL;
+    ts->free_chunk = NULL;
+    ts->nchunks = 0;
+}
+
+/* k 個先のトークン. tokens_peek(0) は次に tokens_next が返すもの */
+Token *
+tokens_peek(TokenStream *ts, int k)
+{
+    assert(k >= 0 && k < CHUNK_LEN);
+    if (ts->stats && k >= ts->stats->max_lookahead) ts->stats->max_lookahead = k + 1;
+    if (ts->pos + k >= ts->filled) fill(ts, ts->pos + k);
+    return tok(ts, ts->pos + k);
+}
+
+Token *
+tokens_next(TokenStream *ts)
+{
+    Token *tk = tokens_peek(ts, 0);
+    if ((++ts->pos & CHUNK_MASK) == 0) retire(ts, (ts->pos >> CHUNK_BITS) - 2);
+    return tk;
+}
+
+long
+tokens_mark(const TokenStream *ts)
+{
+    return ts->pos;
+}
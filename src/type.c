@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "smash.h"
+
+/*
+ * 型の一意化.
+ * 同じ型は常に同じ Type を指すので, 型の比較はポインタの比較で済む.
+ * 修飾の無い基本型は静的な表に置いて全体で共有し,
+ * それ以外は TypeTable ごとのハッシュ表で探す. 比べてよいのは同じ表の型どうしだけ.
+ * Type と TypeInfo は一度作ったら変更してはならない.
+ */
+
+#define FLAG_STATIC   (1 << 0)
+#define FLAG_REGISTER (1 << 1)
+#define FLAG_CONST    (1 << 2)
+#define FLAG_RESTRICT (1 << 3)
+#define FLAG_VOLATILE (1 << 4)
+
+static Type prims[T_LDOUBLE + 1] =
+{
+    [T_VOID]    = {.kind = T_VOID},
+    [T_CHAR]    = {.kind = T_CHAR},
+    [T_SHORT]   = {.kind = T_SHORT},
+    [T_INT]     = {.kind = T_INT},
+    [T_LINT]    = {.kind = T_LINT},
+    [T_LLINT]   = {.kind = T_LLINT},
+    [T_UCHAR]   = {.kind = T_UCHAR},
+    [T_USHORT]  = {.kind = T_USHORT},
+    [T_UINT]    = {.kind = T_UINT},
+    [T_ULINT]   = {.kind = T_ULINT},
+    [T_ULLINT]  = {.kind = T_ULLINT},
+    [T_FLOAT]   = {.kind = T_FLOAT},
+    [T_DOUBLE]  = {.kind = T_DOUBLE},
+    [T_LDOUBLE] = {.kind = T_LDOUBLE},
+};
+
+static unsigned int flags(const Type *t);
+static unsigned int hash_type(const Type *t);
+static bool         same_type(const Type *a, const Type *b);
+static void         rehash_types(TypeTable *tt);
+static unsigned int hash_info(Type *const *member, int n);
+static void         rehash_infos(TypeTable *tt);
+static Type         *intern_type(TypeTable *tt, const Type *temp);
+
+static unsigned int
+flags(const Type *t)
+{
+    return (t->is_static   ? FLAG_STATIC   : 0)
+         | (t->is_register ? FLAG_REGISTER : 0)
+         | (t->is_const    ? FLAG_CONST    : 0)
+         | (t->is_restrict ? FLAG_RESTRICT : 0)
+         | (t->is_volatile ? FLAG_VOLATILE : 0);
+}
+
+static unsigned int
+hash_type(const Type *t)
+{
+    unsigned long long h = (unsigned long long)t->kind * 0x9e3779b1u;
+    h ^= (size_t)t->ptr + (h << 6) + (h >> 2);
+    h ^= (size_t)t->ti  + (h << 6) + (h >> 2);
+    h ^= flags(t)       + (h << 6) + (h >> 2);
+    return (unsigned int)(h ^ (h >> 32));
+}
+
+static bool
+same_type(const Type *a, const Type *b)
+{
+    return a->kind == b->kind && a->ptr == b->ptr && a->ti == b->ti
+        && flags(a) == flags(b);
+}
+
+static void
+rehash_types(TypeTable *tt)
+{
+    Type **old = tt->types;
+    int i, j, size = tt->types_size;
+
+    tt->types_size = tt->types_size ? tt->types_size * 2 : 256;
+    tt->types = (Type**)xcalloc(tt->types_size, sizeof(Type*));
+    for (i = 0; i < size; i++)
+    {
+        if (!old[i]) continue;
+        for (j = hash_type(old[i]) & (tt->types_size-1); tt->types[j]; j = (j + 1) & (tt->types_size-1));
+        tt->types[j] = old[i];
+    }
+    free(old);
+}
+
+/* temp と等しい型を返す. 無ければ複製して登録する */
+static Type *
+intern_type(TypeTable *tt, const Type *temp)
+{
+    Type *t;
+    int i, mask;
+
+    if (temp->kind <= T_LDOUBLE && !temp->ptr && !temp->ti && !flags(temp))
+    {
+        return &prims[temp->kind];
+    }
+
+    if (tt->ntypes * 2 >= tt->types_size) rehash_types(tt);
+    mask = tt->types_size - 1;
+    for (i = hash_type(temp) & mask; tt->types[i]; i = (i + 1) & mask)
+    {
+        if (same_type(tt->types[i], temp)) return tt->types[i];
+    }
+
+    t = (Type*)xmalloc(sizeof(Type));
+    *t = *temp;
+    tt->types[i] = t;
+    tt->ntypes++;
+    return t;
+}
+
+static unsigned int
+hash_info(Type *const *member, int n)
+{
+    unsigned long long h = n;
+    int i;
+    for (i = 0; i < n; i++) h ^= (size_t)member[i] + 0x9e3779b1u + (h << 6) + (h >> 2);
+    return (unsigned int)(h ^ (h >> 32));
+}
+
+static void
+rehash_infos(TypeTable *tt)
+{
+    TypeInfo **old = tt->infos;
+    int i, j, size = tt->infos_size;
+
+    tt->infos_size = tt->infos_size ? tt->infos_size * 2 : 64;
+    tt->infos = (TypeInfo**)xcalloc(tt->infos_size, sizeof(TypeInfo*));
+    for (i = 0; i < size; i++)
+    {
+        TypeInfo *ti = old[i];
+        if (!ti) continue;
+        j = hash_info((Type**)ti->member->body, vec_cnt(ti->member)) & (tt->infos_size-1);
+        for (; tt->infos[j]; j = (j + 1) & (tt->infos_size-1));
+        tt->infos[j] = ti;
+    }
+    free(old);
+}
+
+void
+type_init(TypeTable *tt)
+{
+    tt->types = NULL;
+    tt->ntypes = tt->types_size = 0;
+    tt->infos = NULL;
+    tt->ninfos = tt->infos_size = 0;
+}
+
+/* 表の型をすべて解放する */
+void
+type_close(TypeTable *tt)
+{
+    int i;
+    for (i = 0; i < tt->types_size; i++) free(tt->types[i]);
+    for (i = 0; i < tt->infos_size; i++)
+    {
+        if (!tt->infos[i]) continue;
+        free_vector(tt->infos[i]->member);
+        free(tt->infos[i]);
+    }
+    free(tt->types);
+    free(tt->infos);
+    type_init(tt);
+}
+
+/* 基本型. 修飾の無いものは常に同じ Type */
+Type *
+type_prim(int kind)
+{
+    return &prims[kind];
+}
+
+Type *
+type_ptr(TypeTable *tt, Type *to)
+{
+    return intern_type(tt, &(Type){.kind = T_PTR, .ptr = to});
+}
+
+/* t に修飾子を加えた型 */
+Type *
+type_qualified(TypeTable *tt, Type *t, bool is_const, bool is_restrict, bool is_volatile)
+{
+    Type temp = *t;
+    temp.is_const    |= is_const;
+    temp.is_restrict |= is_restrict;
+    temp.is_volatile |= is_volatile;
+    return intern_type(tt, &temp);
+}
+
+/* t に記憶域クラスを加えた型 */
+Type *
+type_storage(TypeTable *tt, Type *t, bool is_static, bool is_register)
+{
+    Type temp = *t;
+    temp.is_static   |= is_static;
+    temp.is_register |= is_register;
+    return intern_type(tt, &temp);
+}
+
+/* T_STRUCT, T_UNION, T_ENUM */
+Type *
+type_struct(TypeTable *tt, int kind, TypeInfo *ti)
+{
+    return intern_type(tt, &(Type){.kind = kind, .ti = ti});
+}
+
+/* メンバの型の列. 同じ列には同じ TypeInfo を返す */
+TypeInfo *
+type_info(TypeTable *tt, Type *const *member, int n)
+{
+    TypeInfo *ti;
+    unsigned int h = hash_info(member, n);
+    int i, j, mask;
+
+    if (tt->ninfos * 2 >= tt->infos_size) rehash_infos(tt);
+    mask = tt->infos_size - 1;
+    for (i = h & mask; tt->infos[i]; i = (i + 1) & mask)
+    {
+        Vector *m = tt->infos[i]->member;
+        if (vec_cnt(m) == n && memcmp(m->body, member, sizeof(Type*)*n) == 0)
+        {
+            return tt->infos[i];
+        }
+    }
+
+    ti = (TypeInfo*)xmalloc(sizeof(TypeInfo));
+    ti->member = make_vector();
+    for (j = 0; j < n; j++) vec_push(ti->member, member[j]);
+    tt->infos[i] = ti;
+    tt->ninfos++;
+    return ti;
+}
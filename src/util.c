@@ -1,5 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/resource.h>
+#include "smash.h"
+
+/* このスレッドで xmalloc, xcalloc, xrealloc を呼んだ回数と要求したバイト数 */
+static __thread unsigned long alloc_calls;
+static __thread unsigned long long alloc_bytes;
 
 void
 eperror(const char *msg)
@@ -7,3 +13,50 @@ eperror(const char *msg)
     perror(msg);
     exit(EXIT_FAILURE);
 }
+
+void *
+xmalloc(size_t size)
+{
+    void *p = malloc(size);
+    if (!p && size) eperror("malloc");
+    alloc_calls++;
+    alloc_bytes += size;
+    return p;
+}
+
+void *
+xcalloc(size_t n, size_t size)
+{
+    void *p = calloc(n, size);
+    if (!p && n && size) eperror("calloc");
+    alloc_calls++;
+    alloc_bytes += n * size;
+    return p;
+}
+
+void *
+xrealloc(void *p, size_t size)
+{
+    p = realloc(p, size);
+    if (!p && size) eperror("realloc");
+    alloc_calls++;
+    alloc_bytes += size;
+    return p;
+}
+
+/* 差を取って使う. 値は呼んだスレッドの分だけ */
+void
+alloc_counts(unsigned long *calls, unsigned long long *bytes)
+{
+    *calls = alloc_calls;
+    *bytes = alloc_bytes;
+}
+
+/* このプロセスの最大常駐メモリ. KB */
+long
+peak_rss()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
@@ -1,15 +1,32 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include "smash.h"
 
+static void vec_reserve(Vector *vec, int n);
+static void nvec_reserve(NodeVec *v, int n);
+
+/* 長さ n 以上になるように 2 倍ずつ伸ばす */
+static void
+vec_reserve(Vector *vec, int n)
+{
+    int size = vec->size ? vec->size : 8;
+
+    if (n <= vec->size) return;
+    while (size < n) size *= 2;
+    vec->body = (void**)xrealloc(vec->body, sizeof(void*)*size);
+    vec->size = size;
+}
+
+/* 本体は最初に積むときに取る */
 Vector *
 make_vector()
 {
     Vector *vec;
-    vec = (Vector*)malloc(sizeof(Vector));
-    vec->size = 32;
-    vec->body = (void*)malloc(sizeof(void*)*vec->size);
+    vec = (Vector*)xmalloc(sizeof(Vector));
+    vec->size = 0;
+    vec->body = NULL;
     vec->len = 0;
     return vec;
 }
@@ -31,23 +48,17 @@ vec_pop(Vector *vec)
 void
 vec_push(Vector *vec, void *v)
 {
-    if (vec->len > vec->size)
-    {
-        vec->size *= 1.5;
-        vec->body = (void**)realloc(vec->body, sizeof(void*)*vec->size);
-    }
+    if (vec->len >= vec->size) vec_reserve(vec, vec->len + 1);
     vec->body[vec->len++] = v;
 }
 
 void
 vec_concat(Vector *dst, Vector *src)
 {
-    int i;
-    int len = vec_cnt(src);
-    for (i = 0; i < len; ++i)
-    {
-        vec_push(dst, src->body[i]);
-    }
+    if (src->len == 0) return;
+    vec_reserve(dst, dst->len + src->len);
+    memcpy(dst->body + dst->len, src->body, sizeof(void*)*src->len);
+    dst->len += src->len;
 }
 
 void *
@@ -63,3 +74,69 @@ vec_cnt(const Vector *vec)
     return vec->len;
 }
 
+
+/* 長さ n 以上になるように伸ばす. buf から溢れるときに body に移す */
+static void
+nvec_reserve(NodeVec *v, int n)
+{
+    int size = v->body ? v->size : NODEVEC_INLINE;
+
+    if (n <= size) return;
+    while (size < n) size *= 2;
+    if (v->body)
+    {
+        v->body = (Node**)xrealloc(v->body, sizeof(Node*)*size);
+    }
+    else
+    {
+        v->body = (Node**)xmalloc(sizeof(Node*)*size);
+        memcpy(v->body, v->buf, sizeof(Node*)*v->len);
+    }
+    v->size = size;
+}
+
+Node **
+nvec_body(NodeVec *v)
+{
+    return v->body ? v->body : v->buf;
+}
+
+void
+nvec_push(NodeVec *v, Node *node)
+{
+    nvec_reserve(v, v->len + 1);
+    nvec_body(v)[v->len++] = node;
+}
+
+void
+nvec_append(NodeVec *v, const NodeVec *src)
+{
+    if (src->len == 0) return;
+    nvec_reserve(v, v->len + src->len);
+    memcpy(nvec_body(v) + v->len, src->body ? src->body : src->buf, sizeof(Node*)*src->len);
+    v->len += src->len;
+}
+
+/* 空に戻す. buf に戻るので続けて使える */
+void
+nvec_free(NodeVec *v)
+{
+    free(v->body);
+    v->body = NULL;
+    v->len = v->size = 0;
+}
+
+/*
+ * 読み終えた列をちょうどの長さでアリーナに写し, v は空に戻す.
+ * AST の列は作った後に伸ばさないので, ノードと一緒にまとめて解放できる.
+ */
+Vector *
+nvec_freeze(NodeVec *v, Arena *a)
+{
+    Vector *vec = (Vector*)arena_alloc(a, sizeof(Vector) + sizeof(void*)*v->len);
+    vec->body = (void**)(vec + 1);
+    vec->size = vec->len = v->len;
+    memcpy(vec->body, nvec_body(v), sizeof(void*)*v->len);
+    nvec_free(v);
+    return vec;
+}